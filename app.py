@@ -11,6 +11,7 @@ from flask import (
 )
 import os
 import threading
+import queue
 import time
 import uuid
 import contextlib
@@ -21,11 +22,14 @@ from deepface import DeepFace
 import json
 import secrets
 import cv2
+import numpy as np
 import requests
-from concurrent.futures import ThreadPoolExecutor
-from functools import wraps
-from typing import Dict, Any, Optional
+from concurrent.futures import Future, ThreadPoolExecutor
+from werkzeug.serving import WSGIRequestHandler
+from typing import Dict, Any, Optional, Callable
 import shutil
+import sqlite3
+from collections import deque
 
 from telegram_bot import create_telegram_bot, TelegramConfig
 
@@ -36,28 +40,65 @@ app.secret_key = secrets.token_hex(16)
 UPLOAD_FOLDER = "uploads"
 KNOWN_FOLDER = "known_faces"
 STATIC_FOLDER = "static"
+# Kept outside KNOWN_FOLDER so thumbnails never end up in the face index
+THUMB_FOLDER = "thumbnails"
 
 os.makedirs(UPLOAD_FOLDER, exist_ok=True)
 os.makedirs(KNOWN_FOLDER, exist_ok=True)
 os.makedirs(STATIC_FOLDER, exist_ok=True)
+os.makedirs(os.path.join(THUMB_FOLDER, UPLOAD_FOLDER), exist_ok=True)
+os.makedirs(os.path.join(THUMB_FOLDER, KNOWN_FOLDER), exist_ok=True)
+
+THUMB_MAX_SIDE = 240
+THUMB_JPEG_QUALITY = 75
+IMAGE_CACHE_SECONDS = 365 * 24 * 3600  # image URLs never change content (see image_version)
 
 ADMIN_USER = os.getenv("ADMIN_USER", "admin")  # Default to "admin" if not set
 ADMIN_PASS = os.getenv("ADMIN_PASS", "default")  # Default to "default" if not set
 
 ESP32_IP = "192.168.0.100"
+ESP32_STREAM_PORT = 81  # /stream is served by the ESP32's second httpd instance
+CAPTURE_MAX_AGE_MS = 200  # accept a cached ESP32 frame up to this old
+
+# Server-side detection on the ESP32 stream: one connection per camera, with a
+# frame handed to the recognition worker at most every INTERVAL seconds
+STREAM_INGEST_ENABLED = os.getenv("STREAM_INGEST_ENABLED", "1") == "1"
+STREAM_INGEST_INTERVAL_SECONDS = float(os.getenv("STREAM_INGEST_INTERVAL", "2"))
+STREAM_INGEST_COOLDOWN_SECONDS = 8  # after a detected face, let the visit play out
+STREAM_INGEST_MAX_BACKOFF_SECONDS = 30
+DEVICE_HEALTH_INTERVAL_SECONDS = 10
+
+FACE_MODEL = "VGG-Face"
+FACE_MATCH_THRESHOLD = 0.68  # DeepFace's cosine distance threshold for VGG-Face
+FACE_INDEX_CACHE = os.path.join(KNOWN_FOLDER, ".embeddings.npz")
+FACE_IMAGE_EXTENSIONS = (".jpg", ".jpeg", ".png")
 
 notifications = []
 
-sse_clients = []
+sse_clients = []  # one queue.Queue per connected /events client
+SSE_HEARTBEAT_SECONDS = 15  # ping only after this long without an event
+SSE_CLIENT_QUEUE_SIZE = 100  # a stalled client loses its oldest events, not memory
+
+ACCESS_DB = "access_history.db"
+HISTORY_PAGE_SIZE = 50
+HISTORY_MAX_PAGE_SIZE = 500
+
+# Recognition worker: one warm thread, a bounded queue per camera
+RECOGNITION_QUEUE_SIZE = 8  # default per-camera quota of queued jobs
+RECOGNITION_COALESCE_SECONDS = 1.0  # same-key jobs within this window share one result
+RECOGNITION_MAX_AGE_SECONDS = 10  # jobs still queued after this are dropped as stale
+RECOGNITION_WAIT_SECONDS = 20  # how long a request waits for its detection result
+ENROLL_LANE = "enroll"  # worker lane for known-face embeddings
 
-access_history = []  # List to store access attempts with status
+# Disk writes happen off the request and recognition path
+persist_executor = ThreadPoolExecutor(max_workers=1, thread_name_prefix="persist")
 
-# Thread pool
-executor = ThreadPoolExecutor(max_workers=2)
+# Camera HTTP calls (captures, door commands) stay off the recognition worker,
+# so a slow or offline camera cannot hold up the other lanes
+camera_io_executor = ThreadPoolExecutor(max_workers=4, thread_name_prefix="camera-io")
 
 # Thread locks for thread safety
 notifications_lock = threading.Lock()
-access_history_lock = threading.Lock()
 sse_clients_lock = threading.Lock()
 
 telegram_bot = create_telegram_bot()
@@ -106,28 +147,163 @@ class ResourceManager:
                 self.cleanup_file(file_path)
 
 
+class FaceEmbeddingIndex:
+    """In-memory matrix of known-face embeddings with cosine search.
+
+    Rows are L2-normalized, so one matrix-vector product gives the cosine
+    similarity to every resident. Add/delete update the matrix in place
+    instead of rescanning KNOWN_FOLDER, and embeddings are cached on disk by
+    file mtime so a restart only computes new or changed faces.
+    """
+
+    def __init__(self, folder: str, cache_path: str):
+        self.folder = folder
+        self.cache_path = cache_path
+        self.filenames = []
+        self.mtimes = []
+        self.matrix = np.zeros((0, 0), dtype=np.float32)
+        self.lock = threading.Lock()
+
+    @staticmethod
+    def embed(img) -> list:
+        """Normalized embeddings of every face in an image path or BGR array"""
+        faces = DeepFace.represent(
+            img_path=img, model_name=FACE_MODEL, enforce_detection=False
+        )
+        vectors = []
+        for face in faces:
+            vector = np.asarray(face["embedding"], dtype=np.float32)
+            norm = np.linalg.norm(vector)
+            if norm > 0:
+                vectors.append(vector / norm)
+        return vectors
+
+    def build(self):
+        """Load the cache and embed only faces that are new or changed"""
+        cached = {}
+        if os.path.exists(self.cache_path):
+            try:
+                data = np.load(self.cache_path)
+                for filename, mtime, vector in zip(
+                    data["filenames"], data["mtimes"], data["matrix"]
+                ):
+                    cached[str(filename)] = (float(mtime), vector)
+            except Exception as e:
+                print(f"[⚠️] Cache embeddings invalid, recalculez: {e}")
+
+        filenames, mtimes, vectors = [], [], []
+        for filename in sorted(os.listdir(self.folder)):
+            if not filename.lower().endswith(FACE_IMAGE_EXTENSIONS):
+                continue
+            mtime = os.path.getmtime(os.path.join(self.folder, filename))
+            if filename in cached and cached[filename][0] == mtime:
+                vector = cached[filename][1]
+            else:
+                vector = self._embed_file(filename)
+                if vector is None:
+                    continue
+            filenames.append(filename)
+            mtimes.append(mtime)
+            vectors.append(vector)
+
+        with self.lock:
+            self.filenames = filenames
+            self.mtimes = mtimes
+            self.matrix = (
+                np.stack(vectors) if vectors else np.zeros((0, 0), dtype=np.float32)
+            )
+            self._save()
+        print(f"[🧠] Index fețe: {len(filenames)} persoane")
+
+    def _embed_file(self, filename: str) -> Optional[np.ndarray]:
+        try:
+            vectors = self.embed(os.path.join(self.folder, filename))
+        except Exception as e:
+            print(f"[⚠️] Nu pot calcula embedding pentru {filename}: {e}")
+            return None
+        if not vectors:
+            print(f"[⚠️] Nicio față în {filename}")
+            return None
+        return vectors[0]
+
+    def _save(self):
+        """Persist the index; caller holds the lock"""
+        try:
+            with open(self.cache_path, "wb") as f:
+                np.savez(
+                    f,
+                    filenames=np.array(self.filenames),
+                    mtimes=np.array(self.mtimes),
+                    matrix=self.matrix,
+                )
+        except Exception as e:
+            print(f"[⚠️] Nu pot salva cache-ul de embeddings: {e}")
+
+    def add(self, filename: str) -> bool:
+        """Embed one known face and insert or replace its row"""
+        vector = self._embed_file(filename)
+        if vector is None:
+            return False
+        mtime = os.path.getmtime(os.path.join(self.folder, filename))
+
+        with self.lock:
+            if filename in self.filenames:
+                i = self.filenames.index(filename)
+                self.matrix[i] = vector
+                self.mtimes[i] = mtime
+            else:
+                self.filenames.append(filename)
+                self.mtimes.append(mtime)
+                self.matrix = (
+                    np.vstack([self.matrix, vector])
+                    if len(self.matrix)
+                    else vector[np.newaxis, :]
+                )
+            self._save()
+        return True
+
+    def remove(self, filename: str):
+        with self.lock:
+            if filename not in self.filenames:
+                return
+            i = self.filenames.index(filename)
+            del self.filenames[i]
+            del self.mtimes[i]
+            self.matrix = np.delete(self.matrix, i, axis=0)
+            self._save()
+
+    def search(self, vectors: list) -> tuple:
+        """(filename, cosine distance) of the closest known face, or (None, None)"""
+        with self.lock:
+            if not vectors or len(self.filenames) == 0:
+                return None, None
+            similarity = np.stack(vectors) @ self.matrix.T
+            probe, row = np.unravel_index(np.argmax(similarity), similarity.shape)
+            return self.filenames[row], float(1.0 - similarity[probe, row])
+
+
+face_index = FaceEmbeddingIndex(KNOWN_FOLDER, FACE_INDEX_CACHE)
+
+
 class FaceRecognitionService:
     """Centralized face recognition service"""
 
     @staticmethod
-    def recognize_face(image_path: str) -> Dict[str, Any]:
-        """Unified face recognition logic"""
+    def decode(image_data: bytes):
+        """JPEG/PNG bytes to a BGR array, or None if they do not decode"""
+        return cv2.imdecode(np.frombuffer(image_data, np.uint8), cv2.IMREAD_COLOR)
+
+    @staticmethod
+    def recognize_face(image) -> Dict[str, Any]:
+        """Unified face recognition logic; image is a path or a decoded BGR array"""
         try:
-            result = DeepFace.find(
-                img_path=image_path,
-                db_path=KNOWN_FOLDER,
-                model_name="VGG-Face",
-                enforce_detection=False,
-            )
+            filename, distance = face_index.search(FaceEmbeddingIndex.embed(image))
 
-            match_found = len(result) > 0 and not result[0].empty
+            match_found = filename is not None and distance <= FACE_MATCH_THRESHOLD
             recognized_person = None
 
             if match_found:
-                best_match_path = result[0].iloc[0]["identity"]
-                recognized_person = os.path.splitext(os.path.basename(best_match_path))[
-                    0
-                ]
+                recognized_person = os.path.splitext(filename)[0]
 
             return {
                 "access_granted": match_found,
@@ -143,6 +319,214 @@ class FaceRecognitionService:
             }
 
 
+class FrameSelector:
+    """Picks the frame of an event clip most worth recognizing"""
+
+    face_cascade = cv2.CascadeClassifier(
+        cv2.data.haarcascades + "haarcascade_frontalface_default.xml"
+    )
+
+    @staticmethod
+    def sharpness(gray) -> float:
+        """Variance of the Laplacian: higher means more in focus"""
+        return float(cv2.Laplacian(gray, cv2.CV_64F).var())
+
+    @staticmethod
+    def score(image_data: bytes) -> tuple:
+        """(has frontal face, sharpness of the largest face or the whole frame)"""
+        img = cv2.imdecode(np.frombuffer(image_data, np.uint8), cv2.IMREAD_GRAYSCALE)
+        if img is None:
+            return (False, -1.0)
+
+        faces = FrameSelector.face_cascade.detectMultiScale(
+            img, scaleFactor=1.1, minNeighbors=5
+        )
+        if len(faces) == 0:
+            return (False, FrameSelector.sharpness(img))
+
+        x, y, w, h = max(faces, key=lambda f: f[2] * f[3])
+        return (True, FrameSelector.sharpness(img[y : y + h, x : x + w]))
+
+    @staticmethod
+    def best_frame(frames: list) -> int:
+        """Index of the best frame: a frontal face beats none, then sharpest wins"""
+        scores = [FrameSelector.score(frame) for frame in frames]
+        return max(range(len(frames)), key=lambda i: scores[i])
+
+
+class AccessHistoryStore:
+    """Persistent access history in SQLite.
+
+    Every insert or update stamps the row with a new version, so a client
+    that remembers the last version it saw can fetch just the rows added or
+    changed since then. seq orders rows by arrival and is the cursor for
+    paging back through older history.
+    """
+
+    def __init__(self, path: str):
+        self.conn = sqlite3.connect(path, check_same_thread=False)
+        self.conn.row_factory = sqlite3.Row
+        self.lock = threading.Lock()
+        with self.lock, self.conn:
+            self.conn.execute("PRAGMA journal_mode=WAL")
+            self.conn.execute(
+                """CREATE TABLE IF NOT EXISTS access_records (
+                    seq INTEGER PRIMARY KEY AUTOINCREMENT,
+                    version INTEGER NOT NULL,
+                    id TEXT UNIQUE NOT NULL,
+                    timestamp TEXT NOT NULL,
+                    filename TEXT NOT NULL,
+                    status TEXT NOT NULL,
+                    method TEXT,
+                    recognized_person TEXT,
+                    data TEXT NOT NULL
+                )"""
+            )
+            for column in ("version", "timestamp", "status", "recognized_person", "filename"):
+                self.conn.execute(
+                    f"CREATE INDEX IF NOT EXISTS idx_access_{column} ON access_records({column})"
+                )
+            self.version = self.conn.execute(
+                "SELECT COALESCE(MAX(version), 0) FROM access_records"
+            ).fetchone()[0]
+
+    @staticmethod
+    def _row(row) -> Dict:
+        record = json.loads(row["data"])
+        record["seq"] = row["seq"]
+        record["version"] = row["version"]
+        return record
+
+    def add(self, record: Dict):
+        with self.lock, self.conn:
+            self.version += 1
+            self.conn.execute(
+                """INSERT INTO access_records
+                   (version, id, timestamp, filename, status, method, recognized_person, data)
+                   VALUES (?, ?, ?, ?, ?, ?, ?, ?)""",
+                (
+                    self.version,
+                    record["id"],
+                    record["timestamp"],
+                    record["filename"],
+                    record["status"],
+                    record["method"],
+                    record.get("recognized_person"),
+                    json.dumps(record),
+                ),
+            )
+
+    def update_by_filename(self, filename: str, mutate: Callable[[Dict], None]) -> Optional[Dict]:
+        """Mutate the newest record for a file in place; returns the updated record"""
+        with self.lock, self.conn:
+            row = self.conn.execute(
+                "SELECT * FROM access_records WHERE filename = ? ORDER BY seq DESC LIMIT 1",
+                (filename,),
+            ).fetchone()
+            if row is None:
+                return None
+
+            record = json.loads(row["data"])
+            mutate(record)
+            self.version += 1
+            self.conn.execute(
+                """UPDATE access_records
+                   SET version = ?, status = ?, method = ?, recognized_person = ?, data = ?
+                   WHERE seq = ?""",
+                (
+                    self.version,
+                    record["status"],
+                    record["method"],
+                    record.get("recognized_person"),
+                    json.dumps(record),
+                    row["seq"],
+                ),
+            )
+            record["seq"] = row["seq"]
+            record["version"] = self.version
+            return record
+
+    def filenames(self) -> set:
+        """Every file that has a record, to tell captures without one apart"""
+        with self.lock:
+            rows = self.conn.execute("SELECT DISTINCT filename FROM access_records").fetchall()
+        return {row[0] for row in rows}
+
+    def query(
+        self,
+        limit: int = HISTORY_PAGE_SIZE,
+        before: Optional[int] = None,
+        since_version: Optional[int] = None,
+        status: Optional[str] = None,
+        person: Optional[str] = None,
+        date_from: Optional[str] = None,
+        date_to: Optional[str] = None,
+    ) -> Dict:
+        """One page of records plus the cursors to continue from.
+
+        since_version returns rows changed after that version, oldest change
+        first; otherwise rows come newest first, older than the before seq.
+        """
+        where, params = [], []
+        if since_version is not None:
+            where.append("version > ?")
+            params.append(since_version)
+        if before is not None:
+            where.append("seq < ?")
+            params.append(before)
+        if status:
+            where.append("status = ?")
+            params.append(status)
+        if person:
+            where.append("recognized_person = ?")
+            params.append(person)
+        if date_from:
+            where.append("timestamp >= ?")
+            params.append(date_from)
+        if date_to:
+            where.append("timestamp < ?")
+            params.append(date_to)
+
+        sql = "SELECT * FROM access_records"
+        if where:
+            sql += " WHERE " + " AND ".join(where)
+        sql += " ORDER BY version ASC" if since_version is not None else " ORDER BY seq DESC"
+        sql += " LIMIT ?"
+        params.append(limit + 1)
+
+        with self.lock:
+            rows = self.conn.execute(sql, params).fetchall()
+            version = self.version
+
+        has_more = len(rows) > limit
+        records = [self._row(row) for row in rows[:limit]]
+        if since_version is not None:
+            # Resume from the last delivered change when the page was cut short
+            version = records[-1]["version"] if has_more else version
+
+        return {
+            "records": records,
+            "has_more": has_more,
+            "next_before": records[-1]["seq"] if records and since_version is None else None,
+            "version": version,
+        }
+
+    def stats(self) -> Dict:
+        today = datetime.now().strftime("%Y-%m-%d")
+        with self.lock:
+            row = self.conn.execute(
+                """SELECT COUNT(*) AS total,
+                          COALESCE(SUM(timestamp >= ?), 0) AS today,
+                          COALESCE(SUM(status = 'denied'), 0) AS denied
+                   FROM access_records""",
+                (today,),
+            ).fetchone()
+        return {"total": row["total"], "today": row["today"], "denied": row["denied"]}
+
+
+history_store = AccessHistoryStore(ACCESS_DB)
+
+
 class AccessRecordManager:
     """Manages access records and notifications"""
 
@@ -151,16 +535,44 @@ class AccessRecordManager:
         """Centralized timestamp generation"""
         return datetime.now().strftime("%Y%m%d_%H%M%S")
 
+    @staticmethod
+    def capture_filename(prefix: str, frame_meta: Optional[Dict] = None) -> str:
+        """<prefix>_<timestamp>_<unique>[_<device>].jpg
+
+        The timestamp only has one-second resolution, so the unique part keeps
+        two captures in the same second from overwriting each other; uploads
+        are served as immutable, which relies on a name never being reused.
+        """
+        timestamp = AccessRecordManager.generate_timestamp()
+        unique = uuid.uuid4().hex[:8]
+        device_id = (frame_meta or {}).get("device_id")
+        suffix = f"_{device_id}" if device_id else ""
+        return f"{prefix}_{timestamp}_{unique}{suffix}.jpg"
+
     @staticmethod
     def create_access_record(
-        filename: str, recognition_result: Dict, method: str = "automatic"
+        filename: str,
+        recognition_result: Dict,
+        method: str = "automatic",
+        frame_meta: Optional[Dict] = None,
     ) -> Dict:
         """Centralized access record creation"""
+        frame_meta = frame_meta or {}
+        decided_at = time.time()
+        captured_at = frame_meta.get("captured_at_epoch")
+
         return {
             "id": str(uuid.uuid4()),
             "timestamp": datetime.now().isoformat(),
+            "device_id": frame_meta.get("device_id"),
+            "frame_seq": frame_meta.get("frame_seq"),
+            "captured_at": frame_meta.get("captured_at"),
+            "decision_latency_ms": (
+                round((decided_at - captured_at) * 1000) if captured_at else None
+            ),
             "filename": filename,
             "image_url": f"/uploads/{filename}",
+            "thumb_url": f"/uploads/thumb/{filename}",
             "access_granted": recognition_result["access_granted"],
             "status": recognition_result["status"],
             "method": method,
@@ -175,10 +587,7 @@ class AccessRecordManager:
     @staticmethod
     def add_access_record(record: Dict):
         """Thread-safe record addition"""
-        with access_history_lock:
-            access_history.insert(0, record)
-            if len(access_history) > 50:
-                access_history.pop()
+        history_store.add(record)
 
     @staticmethod
     def create_notification(record: Dict) -> Dict:
@@ -188,6 +597,7 @@ class AccessRecordManager:
             "timestamp": record["timestamp"],
             "filename": record["filename"],
             "image_url": record["image_url"],
+            "thumb_url": record["thumb_url"],
             "access_granted": record["access_granted"],
             "status": record["status"],
             "recognition_result": record["recognition_result"],
@@ -204,17 +614,16 @@ class AccessRecordManager:
 
 
 class ESP32Controller:
-    """Handles ESP32 communication"""
+    """Handles ESP32 communication; device defaults to the registry's default camera"""
 
     @staticmethod
-    def open_door() -> Dict[str, Any]:
+    def open_door(device: Optional["CameraDevice"] = None) -> Dict[str, Any]:
         """Centralized door opening logic"""
+        device = device or device_registry.default()
         try:
-            response = requests.get(
-                f"http://{ESP32_IP}/control?action=open", timeout=10
-            )
+            response = requests.get(device.url("/control?action=open"), timeout=10)
             if response.status_code == 200:
-                print("[🚪] Comandă de deschidere trimisă către ESP32")
+                print(f"[🚪] Comandă de deschidere trimisă către ESP32 ({device.id})")
                 return {"success": True, "message": "Door opened successfully"}
             else:
                 print(
@@ -229,48 +638,322 @@ class ESP32Controller:
             return {"success": False, "message": f"Connection error: {str(e)}"}
 
     @staticmethod
-    def capture_image() -> Optional[bytes]:
+    def capture_image(device: Optional["CameraDevice"] = None) -> Optional[bytes]:
         """Capture image from ESP32"""
+        image_data, _ = ESP32Controller.capture_frame(device)
+        return image_data
+
+    @staticmethod
+    def capture_frame(device: Optional["CameraDevice"] = None) -> tuple:
+        """Capture image from ESP32 together with its frame metadata"""
+        device = device or device_registry.default()
         try:
-            response = requests.get(f"http://{ESP32_IP}/capture", timeout=10)
+            response = requests.get(
+                device.url(f"/capture?max_age_ms={CAPTURE_MAX_AGE_MS}"),
+                timeout=10,
+            )
             if response.status_code == 200:
-                return response.content
-            return None
+                frame_meta = ESP32Controller.parse_frame_headers(response.headers)
+                frame_meta["device_id"] = device.id
+                return response.content, frame_meta
+            return None, {}
         except requests.exceptions.RequestException:
-            return None
+            return None, {}
+
+    @staticmethod
+    def parse_frame_headers(headers, received_at: Optional[float] = None) -> Dict:
+        """Map ESP32 frame headers to capture sequence and wall-clock capture time.
+
+        X-Frame-Timestamp and X-Device-Time are both microseconds since the
+        device booted, so their difference is the frame age when it was sent.
+        """
+        received_at = received_at or time.time()
+        meta = {}
+        try:
+            if headers.get("X-Frame-Seq"):
+                meta["frame_seq"] = int(headers["X-Frame-Seq"])
+            frame_us = headers.get("X-Frame-Timestamp")
+            device_us = headers.get("X-Device-Time")
+            if frame_us and device_us:
+                captured_at = received_at - (int(device_us) - int(frame_us)) / 1e6
+                meta["frame_timestamp_us"] = int(frame_us)
+                meta["captured_at_epoch"] = captured_at
+                meta["captured_at"] = datetime.fromtimestamp(captured_at).isoformat()
+        except ValueError as e:
+            print(f"[⚠️] Invalid frame headers: {e}")
+        return meta
+
+
+class RecognitionWorker:
+    """Single worker thread that owns all DeepFace calls.
+
+    Everything that touches the model after startup runs here, including
+    known-face enrollment (on ENROLL_LANE); only the initial index build
+    runs before the worker starts. Models are loaded once before the first job. Jobs are queued per lane
+    (one lane per camera) and the lanes are served round-robin, so a busy
+    camera cannot starve the others. Each lane is bounded by its quota:
+    when it is full the lane's oldest job is dropped, and jobs that waited
+    longer than RECOGNITION_MAX_AGE_SECONDS are skipped, so a burst never
+    leaves minutes of stale frames behind. Jobs submitted with the same key
+    within RECOGNITION_COALESCE_SECONDS share one future instead of running
+    twice. Dropped jobs resolve to None.
+    """
+
+    DEFAULT_LANE = "default"
+
+    def __init__(self, quota: int):
+        self.default_quota = quota
+        self.quotas = {}  # lane -> quota, when it differs from the default
+        self.lanes = {}  # lane -> deque of queued jobs
+        self.order = deque()  # round-robin order of lanes
+        self.pending = {}  # coalescing key -> (submitted_at, future)
+        self.lock = threading.Lock()
+        self.ready = threading.Condition(self.lock)
+        self.stats = {"submitted": 0, "coalesced": 0, "dropped": 0, "completed": 0}
+
+    def start(self):
+        thread = threading.Thread(target=self._run, name="recognition", daemon=True)
+        thread.start()
+
+    def set_quota(self, lane: str, quota: int):
+        with self.lock:
+            self.quotas[lane] = max(1, quota)
+
+    def remove_lane(self, lane: str):
+        """Forget a lane, dropping whatever it still has queued"""
+        with self.lock:
+            self.quotas.pop(lane, None)
+            for job in self.lanes.pop(lane, ()):
+                self._drop(job)
+            if lane in self.order:
+                self.order.remove(lane)
 
+    def queued(self) -> Dict[str, int]:
+        with self.lock:
+            return {lane: len(jobs) for lane, jobs in self.lanes.items()}
+
+    @staticmethod
+    def warm_up():
+        """Load the recognition model and the OpenCV detector"""
+        blank = np.zeros((224, 224, 3), dtype=np.uint8)
+        DeepFace.represent(img_path=blank, model_name=FACE_MODEL, enforce_detection=False)
+        DeepFace.extract_faces(
+            img_path=blank, detector_backend="opencv", enforce_detection=False
+        )
+
+    def find(self, key) -> Optional[Future]:
+        """Future of a job with this key still inside the coalescing window"""
+        now = time.time()
+        with self.lock:
+            entry = self.pending.get(key)
+            if entry and now - entry[0] <= RECOGNITION_COALESCE_SECONDS:
+                self.stats["coalesced"] += 1
+                return entry[1]
+        return None
+
+    def submit(self, func, *args, key=None, lane=None, **kwargs) -> Future:
+        now = time.time()
+        lane = lane or self.DEFAULT_LANE
+        with self.lock:
+            for stale_key in [
+                k
+                for k, (t, _) in self.pending.items()
+                if now - t > RECOGNITION_COALESCE_SECONDS
+            ]:
+                del self.pending[stale_key]
+
+            if key is not None and key in self.pending:
+                self.stats["coalesced"] += 1
+                return self.pending[key][1]
+
+            future = Future()
+            if key is not None:
+                self.pending[key] = (now, future)
+            self.stats["submitted"] += 1
+
+            jobs = self.lanes.get(lane)
+            if jobs is None:
+                jobs = self.lanes[lane] = deque()
+                self.order.append(lane)
+
+            # Latest work wins: make room by dropping this lane's oldest job
+            while len(jobs) >= self.quotas.get(lane, self.default_quota):
+                self._drop(jobs.popleft())
+            jobs.append((now, future, func, args, kwargs))
+            self.ready.notify()
+        return future
 
-def async_task(func):
-    """Decorator for running tasks asynchronously"""
+    def _drop(self, job):
+        _, future, func, _, _ = job
+        self.stats["dropped"] += 1
+        print(f"[⚠️] Job de recunoaștere abandonat: {func.__name__}")
+        if future.set_running_or_notify_cancel():
+            future.set_result(None)
 
-    @wraps(func)
-    def wrapper(*args, **kwargs):
-        def run_task():
+    def _next(self):
+        """Oldest job of the next lane with work, in round-robin order"""
+        with self.lock:
+            while True:
+                for _ in range(len(self.order)):
+                    lane = self.order[0]
+                    self.order.rotate(-1)
+                    if self.lanes[lane]:
+                        return self.lanes[lane].popleft()
+                self.ready.wait()
+
+    def _run(self):
+        try:
+            self.warm_up()
+            print("[🧠] Modele de recunoaștere încărcate")
+        except Exception as e:
+            print(f"[❌] Model warm-up error: {e}")
+
+        while True:
+            job = self._next()
+            submitted_at, future, func, args, kwargs = job
+            if time.time() - submitted_at > RECOGNITION_MAX_AGE_SECONDS:
+                with self.lock:
+                    self._drop(job)
+                continue
+            if not future.set_running_or_notify_cancel():
+                continue
             try:
-                return func(*args, **kwargs)
+                future.set_result(func(*args, **kwargs))
+                with self.lock:
+                    self.stats["completed"] += 1
             except Exception as e:
-                print(f"Async task error: {str(e)}")
-                return None
+                print(f"Recognition task error: {str(e)}")
+                future.set_exception(e)
+
+
+recognition_worker = RecognitionWorker(RECOGNITION_QUEUE_SIZE)
+
+
+class ThumbnailService:
+    """Small JPEG previews for the dashboard, kept in THUMB_FOLDER/<folder>/"""
+
+    @staticmethod
+    def path(folder: str, filename: str) -> str:
+        return os.path.join(THUMB_FOLDER, folder, filename)
+
+    @staticmethod
+    def create(folder: str, filename: str, image=None) -> bool:
+        """Write the thumbnail for folder/filename; image is the decoded original if at hand"""
+        if image is None:
+            image = cv2.imread(os.path.join(folder, filename))
+        if image is None:
+            return False
+
+        height, width = image.shape[:2]
+        scale = THUMB_MAX_SIDE / max(height, width)
+        if scale < 1:
+            image = cv2.resize(
+                image,
+                (round(width * scale), round(height * scale)),
+                interpolation=cv2.INTER_AREA,
+            )
+
+        ok, encoded = cv2.imencode(
+            ".jpg", image, [cv2.IMWRITE_JPEG_QUALITY, THUMB_JPEG_QUALITY]
+        )
+        if not ok:
+            return False
+
+        # Write then rename so a request never sees a half-written thumbnail
+        target = ThumbnailService.path(folder, filename)
+        temp = f"{target}.tmp"
+        with open(temp, "wb") as f:
+            f.write(encoded.tobytes())
+        os.replace(temp, target)
+        return True
+
+    @staticmethod
+    def ensure(folder: str, filename: str) -> bool:
+        """Create the thumbnail on first request for images saved before thumbnails existed"""
+        if filename != os.path.basename(filename) or filename.startswith("."):
+            return False
+        if os.path.exists(ThumbnailService.path(folder, filename)):
+            return True
+        if not os.path.exists(os.path.join(folder, filename)):
+            return False
+        return ThumbnailService.create(folder, filename)
+
+    @staticmethod
+    def remove(folder: str, filename: str):
+        with contextlib.suppress(FileNotFoundError):
+            os.remove(ThumbnailService.path(folder, filename))
 
-        # Submit to thread pool
-        future = executor.submit(run_task)
-        return future
 
-    return wrapper
+def image_version(folder: str, filename: str) -> int:
+    """Cache-busting token for image URLs; changes when a file is overwritten"""
+    try:
+        return int(os.path.getmtime(os.path.join(folder, filename)))
+    except OSError:
+        return 0
+
+
+def send_cached_image(folder: str, filename: str):
+    """Serve an image with ETag/Last-Modified validation and a long private lifetime"""
+    response = send_from_directory(folder, filename, max_age=IMAGE_CACHE_SECONDS)
+    response.cache_control.public = False
+    response.cache_control.private = True
+    return response
+
+
+def persist_image_async(image_data: bytes, filename: str) -> Future:
+    """Write an image that backs an access record, and its thumbnail, in the background"""
+
+    def write():
+        with open(os.path.join(UPLOAD_FOLDER, filename), "wb") as f:
+            f.write(image_data)
+        ThumbnailService.create(UPLOAD_FOLDER, filename, FaceRecognitionService.decode(image_data))
 
+    return persist_executor.submit(write)
 
-@async_task
-def process_face_recognition_async(image_path: str, method: str = "automatic"):
-    """Async face recognition processing with Telegram notifications"""
-    print(f"[🤖] Starting face recognition for {image_path}")
 
-    recognition_result = FaceRecognitionService.recognize_face(image_path)
+def open_door_async(device: Optional["CameraDevice"], reason: str) -> Future:
+    """Send the door command from the camera I/O pool instead of the worker"""
+
+    def send():
+        door_result = ESP32Controller.open_door(device)
+        if door_result["success"]:
+            print(f"[🚪] Ușa deschisă automat {reason}")
+        return door_result
+
+    return camera_io_executor.submit(send)
+
+
+def process_face_recognition(
+    image_data: bytes,
+    filename: str,
+    method: str = "automatic",
+    frame_meta: Optional[Dict] = None,
+):
+    """Face recognition processing with Telegram notifications"""
+    print(f"[🤖] Starting face recognition for {filename}")
+
+    # Every frame that gets here produces a record, so its file is written
+    # while recognition runs on the decoded copy
+    saved = persist_image_async(image_data, filename)
+    image = FaceRecognitionService.decode(image_data)
+    if image is None:
+        recognition_result = {
+            "access_granted": False,
+            "recognized_person": None,
+            "status": "error",
+            "error": "Invalid image",
+        }
+    else:
+        recognition_result = FaceRecognitionService.recognize_face(image)
 
     # Create access record
-    filename = os.path.basename(image_path)
     record = AccessRecordManager.create_access_record(
-        filename, recognition_result, method
+        filename, recognition_result, method, frame_meta
     )
+    if record["decision_latency_ms"] is not None:
+        print(
+            f"[⏱️] Frame {record['frame_seq']}: glass-to-decision {record['decision_latency_ms']} ms"
+        )
     AccessRecordManager.add_access_record(record)
 
     # Create and add notification
@@ -281,24 +964,25 @@ def process_face_recognition_async(image_path: str, method: str = "automatic"):
         f"[🤖] Acces {'PERMIS' if recognition_result['access_granted'] else 'REFUZAT'}"
     )
 
-    # SEND TELEGRAM NOTIFICATION HERE
+    # SEND TELEGRAM NOTIFICATION HERE (queued; delivered by the bot's sender thread)
     try:
-        telegram_sent = telegram_bot.send_visitor_notification(
+        telegram_queued = telegram_bot.send_visitor_notification(
             access_granted=recognition_result["access_granted"],
             recognized_person=recognition_result.get("recognized_person"),
-            image_path=image_path,
+            image_data=image_data,
         )
         print(
-            f"[📱] Telegram notification: {'✅ Sent' if telegram_sent else '❌ Failed'}"
+            f"[📱] Telegram notification: {'✅ Queued' if telegram_queued else '❌ Not queued'}"
         )
     except Exception as e:
         print(f"[📱] Telegram notification error: {e}")
 
-    # Handle door opening
+    # Handle door opening, on the camera that saw the visitor
     if recognition_result["access_granted"]:
-        door_result = ESP32Controller.open_door()
-        if door_result["success"]:
-            print("[🚪] Ușa deschisă automat pentru persoană recunoscută")
+        open_door_async(
+            device_registry.resolve((frame_meta or {}).get("device_id")),
+            "pentru persoană recunoscută",
+        )
 
     # Determine event type and notify web clients
     if method == "automatic":
@@ -311,6 +995,12 @@ def process_face_recognition_async(image_path: str, method: str = "automatic"):
     else:
         event_type = "face_recognition_complete"
 
+    # The dashboard loads the image as soon as it sees the event
+    try:
+        saved.result()
+    except Exception as e:
+        print(f"[❌] Eroare la salvarea imaginii {filename}: {e}")
+
     notify_clients(json.dumps({"type": event_type, "data": notification}))
     return record
 
@@ -319,15 +1009,72 @@ def process_face_recognition_async(image_path: str, method: str = "automatic"):
 resource_manager = ResourceManager()
 
 
+def process_face_recognition_async(
+    image_data: bytes,
+    filename: str,
+    method: str = "automatic",
+    frame_meta: Optional[Dict] = None,
+    key=None,
+) -> Future:
+    """Queue face recognition on the recognition worker, in its camera's lane"""
+    return recognition_worker.submit(
+        process_face_recognition,
+        image_data,
+        filename,
+        method,
+        frame_meta,
+        key=key,
+        lane=(frame_meta or {}).get("device_id"),
+    )
+
+
+def process_frame_batch(frames: list, trigger: str):
+    """Pick the best frame of an uploaded batch and run one recognition on it"""
+    best = FrameSelector.best_frame([image_data for image_data, _ in frames])
+    image_data, frame_meta = frames[best]
+    print(f"[🎞️] Lot de {len(frames)} cadre ({trigger}), ales cadrul {best}")
+
+    filename = AccessRecordManager.capture_filename("visitor", frame_meta)
+
+    return process_face_recognition(image_data, filename, "automatic", frame_meta)
+
+
+def process_frame_batch_async(frames: list, trigger: str, device: "CameraDevice") -> Future:
+    """Queue a batch; a repeated trigger within the coalescing window joins it"""
+    return recognition_worker.submit(
+        process_frame_batch,
+        frames,
+        trigger,
+        key=f"upload:{device.id}:{trigger}",
+        lane=device.id,
+    )
+
+
+def enroll_known_face(filename: str) -> bool:
+    """Embed a saved known face on the recognition worker and wait for the index"""
+    future = recognition_worker.submit(face_index.add, filename, lane=ENROLL_LANE)
+    try:
+        return bool(future.result(timeout=RECOGNITION_WAIT_SECONDS))
+    except Exception as e:
+        print(f"[⚠️] Nu pot înrola fața {filename}: {e}")
+        return False
+
+
 def notify_clients(message):
-    """Thread-safe client notification"""
+    """Thread-safe client notification; wakes every /events stream immediately"""
     with sse_clients_lock:
-        # add to end
-        for client_queue in sse_clients:
+        clients = list(sse_clients)
+
+    for client_queue in clients:
+        while True:
             try:
-                client_queue.append(message)
-            except Exception as e:
-                print(f"Error notifying client: {e}")
+                client_queue.put_nowait(message)
+                break
+            except queue.Full:
+                try:
+                    client_queue.get_nowait()
+                except queue.Empty:
+                    pass
 
 
 @app.route("/")
@@ -358,73 +1105,117 @@ def logout():
     return redirect(url_for("login"))
 
 
+def history_item_from_record(record: Dict) -> Dict:
+    timestamp = datetime.fromisoformat(record["timestamp"])
+    return {
+        "filename": record["filename"],
+        "url": record["image_url"],
+        "thumb_url": record["thumb_url"],
+        "date": timestamp.strftime("%d.%m.%Y"),
+        "time": timestamp.strftime("%H:%M:%S"),
+        # Older pages are not in the dashboard's record cache; send the record along
+        "record": record,
+    }
+
+
+def history_item_from_file(filename: str) -> Dict:
+    """Item for a capture without a record; the date comes from the filename"""
+    item = {
+        "filename": filename,
+        "url": f"/uploads/{filename}",
+        "thumb_url": f"/uploads/thumb/{filename}",
+        "date": "Necunoscut",
+        "time": "Necunoscut",
+        "record": None,
+    }
+    # timestamp (format: visitor_YYYYMMDD_HHMMSS.jpg)
+    try:
+        timestamp_str = (
+            filename.replace("visitor_", "")
+            .replace("manual_capture_", "")
+            .replace("stream_capture_", "")
+            .replace(".jpg", "")
+        )
+        if "_" in timestamp_str:
+            date_part = timestamp_str.split("_")[0]  # YYYYMMDD
+            time_part = timestamp_str.split("_")[1]  # HHMMSS
+
+            item["date"] = f"{date_part[6:8]}.{date_part[4:6]}.{date_part[0:4]}"
+            item["time"] = f"{time_part[0:2]}:{time_part[2:4]}:{time_part[4:6]}"
+    except Exception as e:
+        print(f"Error parsing filename {filename}: {e}")
+    return item
+
+
 @app.route("/api/history")
 def get_history():
     if "logged_in" not in session:
         return jsonify({"error": "Neautentificat"}), 401
 
-    files = []
+    # Newest first from the indexed store, continuing with ?before=<seq>. Once
+    # the records run out, captures that have no record (saved before the
+    # store existed) follow, continuing with ?files_before=<filename>.
+    args = request.args
     try:
-        for filename in sorted(os.listdir(UPLOAD_FOLDER), reverse=True):
-            if filename.lower().endswith(".jpg"):
-                # timestamp (format: visitor_YYYYMMDD_HHMMSS.jpg)
-                try:
-                    timestamp_str = (
-                        filename.replace("visitor_", "")
-                        .replace("manual_capture_", "")
-                        .replace("stream_capture_", "")
-                        .replace(".jpg", "")
-                    )
-                    if "_" in timestamp_str:
-                        date_part = timestamp_str.split("_")[0]  # YYYYMMDD
-                        time_part = timestamp_str.split("_")[1]  # HHMMSS
-
-                        formatted_date = (
-                            f"{date_part[6:8]}.{date_part[4:6]}.{date_part[0:4]}"
-                        )
-                        formatted_time = (
-                            f"{time_part[0:2]}:{time_part[2:4]}:{time_part[4:6]}"
-                        )
-
-                        files.append(
-                            {
-                                "filename": filename,
-                                "url": f"/uploads/{filename}",
-                                "date": formatted_date,
-                                "time": formatted_time,
-                            }
-                        )
-                    else:
-                        # Fallback
-                        files.append(
-                            {
-                                "filename": filename,
-                                "url": f"/uploads/{filename}",
-                                "date": "Necunoscut",
-                                "time": "Necunoscut",
-                            }
-                        )
-                except Exception as e:
-                    print(f"Error parsing filename {filename}: {e}")
-                    files.append(
-                        {
-                            "filename": filename,
-                            "url": f"/uploads/{filename}",
-                            "date": "Necunoscut",
-                            "time": "Necunoscut",
-                        }
-                    )
+        limit = min(max(int(args.get("limit", HISTORY_PAGE_SIZE)), 1), HISTORY_MAX_PAGE_SIZE)
+        before = int(args["before"]) if "before" in args else None
+    except ValueError:
+        return jsonify({"error": "Parametri invalizi"}), 400
+    files_before = args.get("files_before")
+
+    items = []
+    if files_before is None:
+        page = history_store.query(limit=limit, before=before)
+        items = [history_item_from_record(record) for record in page["records"]]
+        if page["has_more"]:
+            return jsonify(
+                {"items": items, "has_more": True, "next": {"before": page["next_before"]}}
+            )
+
+    # Only the last pages scan the folder
+    orphans = []
+    try:
+        recorded = history_store.filenames()
+        orphans = sorted(
+            (
+                f
+                for f in os.listdir(UPLOAD_FOLDER)
+                if f.lower().endswith(".jpg")
+                and f not in recorded
+                and (not files_before or f < files_before)
+            ),
+            reverse=True,
+        )
     except Exception as e:
         print(f"Error reading upload folder: {e}")
 
-    return jsonify(files)
+    take = orphans[: limit - len(items)]
+    items.extend(history_item_from_file(filename) for filename in take)
+    has_more = len(orphans) > len(take)
+    return jsonify(
+        {
+            "items": items,
+            "has_more": has_more,
+            "next": {"files_before": take[-1] if take else ""} if has_more else None,
+        }
+    )
 
 
 @app.route("/uploads/<filename>")
 def uploaded_file(filename):
     if "logged_in" not in session:
         return redirect(url_for("login"))
-    return send_from_directory(UPLOAD_FOLDER, filename)
+    # Capture filenames are timestamped and never rewritten
+    return send_cached_image(UPLOAD_FOLDER, filename)
+
+
+@app.route("/uploads/thumb/<filename>")
+def uploaded_thumbnail(filename):
+    if "logged_in" not in session:
+        return redirect(url_for("login"))
+    if not ThumbnailService.ensure(UPLOAD_FOLDER, filename):
+        return jsonify({"error": "Imagine inexistentă"}), 404
+    return send_cached_image(os.path.join(THUMB_FOLDER, UPLOAD_FOLDER), filename)
 
 
 @app.route("/static/<path:filename>")
@@ -463,16 +1254,15 @@ def grant_access(filename):
         notification_updated = False
 
         # Update access history
-        with access_history_lock:
-            for record in access_history:
-                if record["filename"] == filename:
-                    record["access_granted"] = True
-                    record["status"] = "granted"
-                    record["method"] = f"{record['method']}_manual_override"
-                    record["recognition_result"] = "Acces permis manual"
-                    record["manual_grant_timestamp"] = datetime.now().isoformat()
-                    record_updated = True
-                    break
+        def mark_granted(record):
+            record["access_granted"] = True
+            record["status"] = "granted"
+            record["method"] = f"{record['method']}_manual_override"
+            record["recognition_result"] = "Acces permis manual"
+            record["manual_grant_timestamp"] = datetime.now().isoformat()
+
+        updated_record = history_store.update_by_filename(filename, mark_granted)
+        record_updated = updated_record is not None
 
         # Update notifications
         with notifications_lock:
@@ -486,20 +1276,9 @@ def grant_access(filename):
 
         # Notify clients about the status change
         if record_updated:
-            # Find the updated record to send to clients
-            updated_record = None
-            with access_history_lock:
-                for record in access_history:
-                    if record["filename"] == filename:
-                        updated_record = record
-                        break
-
-            if updated_record:
-                notify_clients(
-                    json.dumps(
-                        {"type": "access_granted_manual", "data": updated_record}
-                    )
-                )
+            notify_clients(
+                json.dumps({"type": "access_granted_manual", "data": updated_record})
+            )
 
         return jsonify(
             {
@@ -515,13 +1294,23 @@ def grant_access(filename):
         return jsonify({"success": False, "message": f"Eroare: {str(e)}"}), 500
 
 
+def request_device_id() -> Optional[str]:
+    """Camera named by a dashboard request: ?device=<id> or "device" in the JSON body"""
+    data = request.get_json(silent=True) or {}
+    return data.get("device") or request.args.get("device")
+
+
 @app.route("/api/door/open", methods=["POST"])
 def open_door():
     """Endpoint dedicat pentru deschiderea ușii din dashboard"""
     if "logged_in" not in session:
         return jsonify({"error": "Neautentificat"}), 401
 
-    door_result = ESP32Controller.open_door()
+    device = device_registry.resolve(request_device_id())
+    if device is None:
+        return jsonify({"success": False, "message": "Camera nu există"}), 404
+
+    door_result = ESP32Controller.open_door(device)
 
     if door_result["success"]:
         telegram_bot.send_door_opened_notification("manual")
@@ -532,18 +1321,23 @@ def open_door():
 
 @app.route("/api/camera/status")
 def camera_status():
-    """Verifică statusul conexiunii cu camera ESP32"""
+    """Verifică statusul conexiunii cu camera ESP32 (ultimul rezultat al poller-ului)"""
     if "logged_in" not in session:
         return jsonify({"error": "Neautentificat"}), 401
 
-    try:
-        response = requests.get(f"http://{ESP32_IP}/capture", timeout=3)
-        if response.status_code == 200:
-            return jsonify({"status": "online", "ip": ESP32_IP})
-        else:
-            return jsonify({"status": "offline", "ip": ESP32_IP})
-    except requests.exceptions.RequestException:
-        return jsonify({"status": "offline", "ip": ESP32_IP})
+    device = device_registry.resolve(request_device_id())
+    if device is None:
+        return jsonify({"error": "Camera nu există"}), 404
+
+    return jsonify(
+        {
+            "status": "online" if device.health["online"] else "offline",
+            "device": device.id,
+            "ip": device.ip,
+            "health": device.health["data"],
+            "last_seen": device.health["last_seen"],
+        }
+    )
 
 
 @app.route("/api/settings/camera-ip", methods=["POST"])
@@ -552,15 +1346,18 @@ def update_camera_ip():
     if "logged_in" not in session:
         return jsonify({"error": "Neautentificat"}), 401
 
-    global ESP32_IP
     data = request.get_json()
     new_ip = data.get("ip", "").strip()
+    device = device_registry.resolve(data.get("device"))
+    if device is None:
+        return jsonify({"success": False, "message": "Camera nu există"}), 404
 
     if new_ip:
-        ESP32_IP = new_ip
-        print(f"[⚙️] IP cameră actualizat la: {ESP32_IP}")
+        device.set_ip(new_ip)
+        device_registry.save()
+        print(f"[⚙️] [{device.id}] IP cameră actualizat la: {new_ip}")
         return jsonify(
-            {"success": True, "message": f"IP cameră actualizat la {ESP32_IP}"}
+            {"success": True, "message": f"IP cameră actualizat la {new_ip}"}
         )
     else:
         return jsonify({"success": False, "message": "IP invalid"}), 400
@@ -571,23 +1368,99 @@ def get_access_history():
     if "logged_in" not in session:
         return jsonify({"error": "Neautentificat"}), 401
 
-    with access_history_lock:
-        return jsonify(access_history.copy())
+    # ?since=<version> returns only records added or changed after that
+    # version; otherwise pages go newest first, continuing with ?before=<seq>
+    args = request.args
+    try:
+        limit = min(max(int(args.get("limit", HISTORY_PAGE_SIZE)), 1), HISTORY_MAX_PAGE_SIZE)
+        before = int(args["before"]) if "before" in args else None
+        since = int(args["since"]) if "since" in args else None
+    except ValueError:
+        return jsonify({"error": "Parametri invalizi"}), 400
+
+    return jsonify(
+        history_store.query(
+            limit=limit,
+            before=before,
+            since_version=since,
+            status=args.get("status"),
+            person=args.get("person"),
+            date_from=args.get("from"),
+            date_to=args.get("to"),
+        )
+    )
+
+
+@app.route("/api/access-history/stats")
+def get_access_stats():
+    if "logged_in" not in session:
+        return jsonify({"error": "Neautentificat"}), 401
+
+    return jsonify(history_store.stats())
+
+
+def upload_device() -> "CameraDevice":
+    """Camera an upload came from: X-Device-Id if sent, else matched by address"""
+    return (
+        device_registry.get(request.headers.get("X-Device-Id"))
+        or device_registry.find_by_ip(request.remote_addr)
+        or device_registry.default()
+    )
 
 
 @app.route("/upload", methods=["POST"])
 def upload():
-    timestamp = AccessRecordManager.generate_timestamp()
-    filename = f"visitor_{timestamp}.jpg"
-    file_path = os.path.join(UPLOAD_FOLDER, filename)
+    # Taken before the body is read: X-Device-Time was stamped as the request started
+    received_at = time.time()
+    trigger = request.headers.get("X-Trigger", "unknown")
+    device = upload_device()
+
+    # The ESP32 sends one multipart request per event: the pre-roll clip (or a
+    # single still) as "frame" parts, each with its own sequence/timestamp
+    if request.mimetype == "multipart/form-data":
+        frames = []
+        for part in request.files.getlist("frame"):
+            headers = {
+                "X-Frame-Seq": part.headers.get("X-Frame-Seq"),
+                "X-Frame-Timestamp": part.headers.get("X-Frame-Timestamp"),
+                "X-Device-Time": request.headers.get("X-Device-Time"),
+            }
+            frame_meta = ESP32Controller.parse_frame_headers(headers, received_at)
+            frame_meta["device_id"] = device.id
+            frames.append((part.read(), frame_meta))
+
+        if not frames:
+            return jsonify({"error": "No frames"}), 400
+
+        print(f"[📸] [{device.id}] Lot primit: {len(frames)} cadre (trigger: {trigger})")
+        future = process_frame_batch_async(frames, trigger, device)
+
+        return (
+            jsonify(
+                {
+                    "status": "processing",
+                    "message": "Frames uploaded, processing face recognition...",
+                    "frames": len(frames),
+                    "access_granted": False,  # Will be updated by background process
+                }
+            ),
+            200,
+        )
 
-    with open(file_path, "wb") as f:
-        f.write(request.data)
+    key = f"upload:{device.id}:{trigger}"
+    if recognition_worker.find(key):
+        return jsonify({"status": "processing", "coalesced": True}), 200
 
-    print(f"[📸] Imagine primită și salvată: {file_path}")
+    frame_meta = ESP32Controller.parse_frame_headers(request.headers, received_at)
+    frame_meta["device_id"] = device.id
+    filename = AccessRecordManager.capture_filename("visitor", frame_meta)
+
+    print(f"[📸] Imagine primită: {filename} (trigger: {trigger})")
 
     # Process face recognition asynchronously
-    future = process_face_recognition_async(file_path, "automatic")
+    future = process_face_recognition_async(
+        request.data, filename, "automatic", frame_meta, key=key
+    )
 
     # Return immediate response - ESP32 expects access_granted field
     return (
@@ -609,7 +1482,7 @@ def sse():
         return redirect(url_for("login"))
 
     def event_stream():
-        client_queue = []
+        client_queue = queue.Queue(maxsize=SSE_CLIENT_QUEUE_SIZE)
         with sse_clients_lock:
             sse_clients.append(client_queue)
 
@@ -618,21 +1491,24 @@ def sse():
             yield 'data: {"type": "connected"}\n\n'
 
             while True:
-                if client_queue:
-                    msg = client_queue.pop(0)
+                # Blocks without polling; returns as soon as an event is queued
+                try:
+                    msg = client_queue.get(timeout=SSE_HEARTBEAT_SECONDS)
                     yield f"data: {msg}\n\n"
-                else:
+                except queue.Empty:
                     # Keep-alive
                     yield 'data: {"type": "ping"}\n\n'
-
-                time.sleep(1)
-        except GeneratorExit:
+        finally:
             # clean client when disconnecting
             with sse_clients_lock:
                 if client_queue in sse_clients:
                     sse_clients.remove(client_queue)
 
-    return Response(event_stream(), mimetype="text/event-stream")
+    return Response(
+        event_stream(),
+        mimetype="text/event-stream",
+        headers={"Cache-Control": "no-cache", "X-Accel-Buffering": "no"},
+    )
 
 
 @app.route("/take_photo", methods=["POST"])
@@ -640,60 +1516,70 @@ def take_photo():
     if "logged_in" not in session:
         return jsonify({"error": "Neautentificat"}), 401
 
-    def capture_and_process():
+    device = device_registry.resolve(request_device_id())
+    if device is None:
+        return jsonify({"success": False, "message": "Camera nu există"}), 404
+
+    def process_capture(image_data: bytes, image, frame_meta: Dict):
         try:
-            # Capture image from ESP32
-            image_data = ESP32Controller.capture_image()
-            if image_data:
-                timestamp = AccessRecordManager.generate_timestamp()
-                filename = f"manual_capture_{timestamp}.jpg"
-                file_path = os.path.join(UPLOAD_FOLDER, filename)
+            filename = AccessRecordManager.capture_filename("manual_capture", frame_meta)
+            saved = persist_image_async(image_data, filename)
 
-                with open(file_path, "wb") as f:
-                    f.write(image_data)
+            print(f"[📷] Captură manuală: {filename}")
+
+            # Process face recognition
+            recognition_result = FaceRecognitionService.recognize_face(image)
+            record = AccessRecordManager.create_access_record(
+                filename, recognition_result, "manual", frame_meta
+            )
+            AccessRecordManager.add_access_record(record)
 
-                print(f"[📷] Captură manuală salvată: {file_path}")
+            # Create and add notification
+            notification = AccessRecordManager.create_notification(record)
+            AccessRecordManager.add_notification(notification)
 
-                # Process face recognition
-                recognition_result = FaceRecognitionService.recognize_face(file_path)
-                record = AccessRecordManager.create_access_record(
-                    filename, recognition_result, "manual"
+            # Handle door opening if access granted
+            if recognition_result["access_granted"]:
+                open_door_async(
+                    device, "pentru persoană recunoscută (captură manuală)"
                 )
-                AccessRecordManager.add_access_record(record)
-
-                # Create and add notification
-                notification = AccessRecordManager.create_notification(record)
-                AccessRecordManager.add_notification(notification)
-
-                # Handle door opening if access granted
-                if recognition_result["access_granted"]:
-                    door_result = ESP32Controller.open_door()
-                    if door_result["success"]:
-                        print(
-                            "[🚪] Ușa deschisă automat pentru persoană recunoscută (captură manuală)"
-                        )
-
-                # Notify clients
-                notify_clients(
-                    json.dumps(
-                        {
-                            "type": "manual_capture_with_recognition",
-                            "data": notification,
-                        }
-                    )
+
+            # Notify clients once the image can be served
+            saved.result()
+            notify_clients(
+                json.dumps(
+                    {
+                        "type": "manual_capture_with_recognition",
+                        "data": notification,
+                    }
                 )
+            )
 
-                return record
-            else:
-                return {"success": False, "message": "ESP32 capture failed"}
+            return record
         except Exception as e:
             print(f"[❌] Eroare la captura manuală: {str(e)}")
             return {"success": False, "message": str(e)}
 
-    # Run in background thread
-    thread = threading.Thread(target=capture_and_process)
-    thread.daemon = True
-    thread.start()
+    def capture():
+        # Capture image from ESP32 on the I/O pool; only the decoded frame
+        # goes to the recognition worker
+        image_data, frame_meta = ESP32Controller.capture_frame(device)
+        image = FaceRecognitionService.decode(image_data) if image_data else None
+        if image is None:
+            print(f"[❌] [{device.id}] Captura manuală de pe ESP32 a eșuat")
+            return
+
+        # Clicks within a second share one recognition
+        recognition_worker.submit(
+            process_capture,
+            image_data,
+            image,
+            frame_meta,
+            key=f"manual:{device.id}",
+            lane=device.id,
+        )
+
+    camera_io_executor.submit(capture)
 
     return (
         jsonify(
@@ -713,13 +1599,17 @@ def get_known_faces():
     try:
         for filename in os.listdir(KNOWN_FOLDER):
             if filename.lower().endswith((".jpg", ".jpeg", ".png")):
+                version = image_version(KNOWN_FOLDER, filename)
                 faces.append(
                     {
                         "filename": filename,
                         "name": filename.replace(".jpg", "")
                         .replace(".jpeg", "")
                         .replace(".png", ""),
-                        "url": f"/known_faces/{filename}",
+                        # Faces can be re-saved under the same name, so the
+                        # URLs carry the file version for the long cache lifetime
+                        "url": f"/known_faces/{filename}?v={version}",
+                        "thumb_url": f"/known_faces/thumb/{filename}?v={version}",
                     }
                 )
     except Exception as e:
@@ -753,13 +1643,17 @@ def add_known_face():
 
         if image_source == "capture":
             # Capture new image from ESP32
-            image_data = ESP32Controller.capture_image()
+            image_data = ESP32Controller.capture_image(
+                device_registry.resolve(data.get("device"))
+            )
             if image_data:
                 filename = f"{safe_name}.jpg"
                 file_path = os.path.join(KNOWN_FOLDER, filename)
 
                 with open(file_path, "wb") as f:
                     f.write(image_data)
+                enroll_known_face(filename)
+                ThumbnailService.create(KNOWN_FOLDER, filename)
 
                 print(f"[👤] Față nouă adăugată prin captură: {filename}")
                 return jsonify(
@@ -805,6 +1699,8 @@ def add_known_face():
 
             # Copy file
             shutil.copy2(history_path, new_path)
+            enroll_known_face(filename)
+            ThumbnailService.create(KNOWN_FOLDER, filename)
 
             print(f"[👤] Față nouă adăugată din istoric: {filename}")
             return jsonify(
@@ -854,6 +1750,8 @@ def upload_known_face():
 
         file_path = os.path.join(KNOWN_FOLDER, filename)
         file.save(file_path)
+        enroll_known_face(filename)
+        ThumbnailService.create(KNOWN_FOLDER, filename)
 
         print(f"[👤] Față nouă încărcată: {filename}")
         return jsonify(
@@ -878,6 +1776,8 @@ def delete_known_face(filename):
     if os.path.exists(file_path):
         try:
             os.remove(file_path)
+            face_index.remove(filename)
+            ThumbnailService.remove(KNOWN_FOLDER, filename)
             print(f"[👤] Față ștearsă: {filename}")
             return jsonify({"success": True, "message": "Față ștearsă cu succes!"})
         except Exception as e:
@@ -892,7 +1792,80 @@ def serve_known_face(filename):
     """Serve known face images"""
     if "logged_in" not in session:
         return redirect(url_for("login"))
-    return send_from_directory(KNOWN_FOLDER, filename)
+    return send_cached_image(KNOWN_FOLDER, filename)
+
+
+@app.route("/known_faces/thumb/<filename>")
+def serve_known_face_thumbnail(filename):
+    """Serve known face thumbnails"""
+    if "logged_in" not in session:
+        return redirect(url_for("login"))
+    if not ThumbnailService.ensure(KNOWN_FOLDER, filename):
+        return jsonify({"error": "Imagine inexistentă"}), 404
+    return send_cached_image(os.path.join(THUMB_FOLDER, KNOWN_FOLDER), filename)
+
+
+def detect_stream_face(image_data: bytes, frame_meta: Optional[Dict] = None) -> tuple:
+    """Detector pass for a stream frame; runs on the recognition worker"""
+    image = FaceRecognitionService.decode(image_data)
+    if image is None:
+        return {"face_detected": False, "status": "error"}, 400
+
+    try:
+        # Check if there's actually a face in the image
+        faces = DeepFace.extract_faces(
+            img_path=image,
+            enforce_detection=True,
+            detector_backend="opencv",
+        )
+    except ValueError:
+        # No face detected: nothing was written, nothing to clean up
+        print(f"[👁️] No face detected in stream frame")
+        return (
+            {
+                "face_detected": False,
+                "access_granted": False,
+                "timestamp": datetime.now().isoformat(),
+                "status": "no_face",
+            },
+            200,
+        )
+    except Exception as e:
+        print(f"[❌] Stream detection error: {str(e)}")
+        return {"face_detected": False, "status": "error"}, 500
+
+    # If we get here, at least one face was detected
+    print(f"[👁️] Face detected in stream - processing with Telegram notification...")
+
+    stream_filename = AccessRecordManager.capture_filename("stream_capture", frame_meta)
+
+    # Lets every dashboard show the processing overlay, whoever sent the frame
+    notify_clients(
+        json.dumps(
+            {
+                "type": "stream_face_detected",
+                "data": {
+                    "filename": stream_filename,
+                    "device_id": (frame_meta or {}).get("device_id"),
+                },
+            }
+        )
+    )
+
+    # Queued behind this job, so the detector result goes back right away
+    process_face_recognition_async(
+        image_data, stream_filename, "stream_detection", frame_meta
+    )
+
+    return (
+        {
+            "face_detected": True,
+            "timestamp": datetime.now().isoformat(),
+            "status": "processing",
+            "filename": stream_filename,
+        },
+        200,
+    )
 
 
 @app.route("/api/detect-face-stream", methods=["POST"])
@@ -906,71 +1879,452 @@ def detect_face_stream():
         if not image_file:
             return jsonify({"face_detected": False}), 400
 
-        # Create permanent filename first
-        timestamp = AccessRecordManager.generate_timestamp()
-        stream_filename = f"stream_capture_{timestamp}.jpg"
-        stream_path = os.path.join(UPLOAD_FOLDER, stream_filename)
+        device = device_registry.resolve(request.form.get("device"))
+        if device is None:
+            return jsonify({"face_detected": False, "status": "unknown_device"}), 404
+
+        # Viewers posting within the coalescing window share one detector pass
+        key = f"stream:{device.id}"
+        future = recognition_worker.find(key)
+        if future is None:
+            future = recognition_worker.submit(
+                detect_stream_face,
+                image_file.read(),
+                {"device_id": device.id},
+                key=key,
+                lane=device.id,
+            )
 
-        # Save the image directly to permanent location
-        image_file.save(stream_path)
+        result = future.result(timeout=RECOGNITION_WAIT_SECONDS)
+        if result is None:
+            # Dropped as stale under load
+            return jsonify({"face_detected": False, "status": "busy"}), 503
 
-        try:
-            # Check if there's actually a face in the image
-            faces = DeepFace.extract_faces(
-                img_path=stream_path,
-                enforce_detection=True,
-                detector_backend="opencv",
-            )
+        payload, status_code = result
+        return jsonify(payload), status_code
 
-            # If we get here, at least one face was detected
-            print(
-                f"[👁️] Face detected in stream - processing with Telegram notification..."
-            )
+    except Exception as e:
+        print(f"[❌] Stream detection request error: {str(e)}")
+        return jsonify({"face_detected": False, "status": "error"}), 500
 
-            # Process face recognition asynchronously (this will send Telegram notification)
-            future = process_face_recognition_async(stream_path, "stream_detection")
 
-            return jsonify(
-                {
-                    "face_detected": True,
-                    "timestamp": datetime.now().isoformat(),
-                    "status": "processing",
-                    "filename": stream_filename,
-                }
-            )
+class MultipartFrameParser:
+    """Incremental parser for a multipart/x-mixed-replace MJPEG stream
 
-        except ValueError as face_error:
-            # No face detected, del file
-            try:
-                if os.path.exists(stream_path):
-                    os.remove(stream_path)
-            except Exception as cleanup_error:
-                print(f"Error cleaning up file: {cleanup_error}")
+    feed() takes raw chunks as they arrive and returns the complete parts,
+    as (headers, body) pairs; partial data is kept for the next call.
+    """
 
-            print(f"[👁️] No face detected in stream frame")
-            return jsonify(
-                {
-                    "face_detected": False,
-                    "access_granted": False,
-                    "timestamp": datetime.now().isoformat(),
-                    "status": "no_face",
+    MAX_HEADER_BYTES = 4096
+
+    def __init__(self, boundary: str):
+        self.delimiter = b"--" + boundary.encode()
+        self.buffer = bytearray()
+        self.headers: Optional[Dict[str, str]] = None
+
+    def feed(self, chunk: bytes) -> list:
+        self.buffer += chunk
+        parts = []
+
+        while True:
+            if self.headers is None:
+                end = self.buffer.find(b"\r\n\r\n")
+                if end < 0:
+                    if len(self.buffer) > self.MAX_HEADER_BYTES:
+                        raise ValueError("multipart header too long")
+                    break
+
+                block = bytes(self.buffer[:end]).decode("latin-1")
+                del self.buffer[: end + 4]
+
+                lines = [line for line in block.split("\r\n") if line]
+                if not lines or not lines[0].startswith(self.delimiter.decode()):
+                    raise ValueError("multipart boundary expected")
+
+                self.headers = {}
+                for line in lines[1:]:
+                    name, _, value = line.partition(":")
+                    self.headers[name.strip().lower()] = value.strip()
+
+            length = self.headers.get("content-length")
+            if length is not None:
+                length = int(length)
+                if len(self.buffer) < length:
+                    break
+                body = bytes(self.buffer[:length])
+                del self.buffer[:length]
+            else:
+                # No length: the part runs up to the next delimiter
+                end = self.buffer.find(b"\r\n" + self.delimiter)
+                if end < 0:
+                    break
+                body = bytes(self.buffer[:end])
+                del self.buffer[:end]
+
+            parts.append((self.headers, body))
+            self.headers = None
+
+        return parts
+
+
+class StreamIngestor:
+    """Holds one connection to a camera's /stream and feeds the recognition worker
+
+    Detection runs once per camera instead of once per open dashboard tab.
+    Frames between submissions are parsed and discarded; the JPEG goes to the
+    detector as sent by the camera, without a decode/re-encode round trip.
+    """
+
+    def __init__(self, device: "CameraDevice", interval: float, enabled: bool):
+        self.device = device
+        self.interval = interval
+        self.enabled = enabled
+        self.wake = threading.Event()
+        self.restart = False
+        self.thread = None
+        self.next_submit = 0.0
+        self.stats = {
+            "connected": False,
+            "frames": 0,
+            "submitted": 0,
+            "faces": 0,
+            "reconnects": 0,
+            "last_frame_seq": None,
+        }
+
+    def start(self):
+        if self.thread and self.thread.is_alive():
+            return
+        self.thread = threading.Thread(
+            target=self._run, name=f"stream-ingest-{self.device.id}", daemon=True
+        )
+        self.thread.start()
+
+    def set_enabled(self, enabled: bool):
+        self.enabled = enabled
+        self.wake.set()
+
+    def reconnect(self):
+        """Drop the current connection, e.g. after the camera's address changed"""
+        self.restart = True
+        self.wake.set()
+
+    def status(self) -> Dict[str, Any]:
+        return {"enabled": self.enabled, "interval": self.interval, **self.stats}
+
+    def _on_result(self, future: Future):
+        result = None if future.cancelled() or future.exception() else future.result()
+        if result and result[0].get("face_detected"):
+            self.stats["faces"] += 1
+            self.next_submit = time.monotonic() + STREAM_INGEST_COOLDOWN_SECONDS
+
+    def _offer(self, headers: Dict[str, str], jpeg: bytes):
+        self.stats["frames"] += 1
+        self.stats["last_frame_seq"] = headers.get("x-frame-seq")
+
+        now = time.monotonic()
+        key = f"stream:{self.device.id}"
+        # Skip while a detector pass is still queued rather than stacking them up
+        if now < self.next_submit or recognition_worker.find(key) is not None:
+            return
+
+        self.next_submit = now + self.interval
+        frame_meta = ESP32Controller.parse_frame_headers(
+            {
+                "X-Frame-Seq": headers.get("x-frame-seq"),
+                "X-Frame-Timestamp": headers.get("x-frame-timestamp"),
+                "X-Device-Time": headers.get("x-device-time"),
+            },
+            time.time(),
+        )
+        frame_meta["device_id"] = self.device.id
+        future = recognition_worker.submit(
+            detect_stream_face, jpeg, frame_meta, key=key, lane=self.device.id
+        )
+        future.add_done_callback(self._on_result)
+        self.stats["submitted"] += 1
+
+    def _consume(self):
+        self.restart = False
+        url = self.device.url("/stream", ESP32_STREAM_PORT)
+        with requests.get(url, stream=True, timeout=(5, 10)) as response:
+            response.raise_for_status()
+            content_type = response.headers.get("Content-Type", "")
+            _, _, boundary = content_type.partition("boundary=")
+            parser = MultipartFrameParser(boundary.strip('"') or "frame")
+
+            self.stats["connected"] = True
+            print(f"[🎥] [{self.device.id}] Stream ingest conectat la {url}")
+
+            while self.enabled and self.device.active and not self.restart:
+                chunk = response.raw.read(16384, decode_content=False)
+                if not chunk:
+                    break
+                for headers, jpeg in parser.feed(chunk):
+                    self._offer(headers, jpeg)
+
+    def _run(self):
+        backoff = 1
+        while self.device.active:
+            if not self.enabled:
+                self.wake.wait()
+                self.wake.clear()
+                continue
+
+            try:
+                self._consume()
+                backoff = 1
+            except Exception as e:
+                print(f"[🎥] [{self.device.id}] Stream ingest întrerupt: {e}")
+            finally:
+                if self.stats["connected"]:
+                    self.stats["reconnects"] += 1
+                self.stats["connected"] = False
+
+            if self.enabled:
+                self.wake.wait(backoff)
+                self.wake.clear()
+                backoff = min(backoff * 2, STREAM_INGEST_MAX_BACKOFF_SECONDS)
+
+
+class CameraDevice:
+    """One ESP32 camera: its address plus its own ingest and health poller threads
+
+    Everything that talks to one camera runs on that camera's threads, so a
+    slow or offline device only delays itself. Recognition is shared, with
+    the camera's jobs in their own worker lane limited by queue_quota.
+    """
+
+    def __init__(
+        self,
+        device_id: str,
+        name: str,
+        ip: str,
+        ingest_enabled: bool = STREAM_INGEST_ENABLED,
+        queue_quota: int = RECOGNITION_QUEUE_SIZE,
+    ):
+        self.id = device_id
+        self.name = name
+        self.ip = ip
+        self.queue_quota = queue_quota
+        self.active = True
+        self.health = {"online": False, "last_seen": None, "data": None}
+        self.ingest = StreamIngestor(self, STREAM_INGEST_INTERVAL_SECONDS, ingest_enabled)
+        self.stop_event = threading.Event()
+
+    def url(self, path: str, port: Optional[int] = None) -> str:
+        host = f"{self.ip}:{port}" if port else self.ip
+        return f"http://{host}{path}"
+
+    def set_ip(self, ip: str):
+        self.ip = ip
+        self.health = {"online": False, "last_seen": None, "data": None}
+        self.ingest.reconnect()
+
+    def start(self):
+        recognition_worker.set_quota(self.id, self.queue_quota)
+        self.ingest.start()
+        threading.Thread(
+            target=self._poll_health, name=f"health-{self.id}", daemon=True
+        ).start()
+
+    def stop(self):
+        self.active = False
+        self.stop_event.set()
+        self.ingest.wake.set()
+        recognition_worker.remove_lane(self.id)
+
+    def _poll_health(self):
+        poll_session = requests.Session()
+        while not self.stop_event.is_set():
+            try:
+                response = poll_session.get(self.url("/health"), timeout=3)
+                response.raise_for_status()
+                self.health = {
+                    "online": True,
+                    "last_seen": datetime.now().isoformat(),
+                    "data": response.json(),
                 }
-            )
+            except (requests.exceptions.RequestException, ValueError):
+                if self.health["online"]:
+                    print(f"[📡] [{self.id}] Camera offline ({self.ip})")
+                self.health = {**self.health, "online": False}
+            self.stop_event.wait(DEVICE_HEALTH_INTERVAL_SECONDS)
+
+    def to_config(self) -> Dict[str, Any]:
+        return {
+            "id": self.id,
+            "name": self.name,
+            "ip": self.ip,
+            "ingest_enabled": self.ingest.enabled,
+            "queue_quota": self.queue_quota,
+        }
+
+    def to_dict(self) -> Dict[str, Any]:
+        return {
+            **self.to_config(),
+            "stream_url": self.url("/stream", ESP32_STREAM_PORT),
+            "health": self.health,
+            "ingest": self.ingest.status(),
+            "queued": recognition_worker.queued().get(self.id, 0),
+        }
+
+
+class DeviceRegistry:
+    """Cameras known to the server, persisted in devices.json
+
+    The first device is the default, used wherever a request does not name
+    a camera; without a config file it is seeded from ESP32_IP.
+    """
 
+    CONFIG_FILE = "devices.json"
+
+    def __init__(self):
+        self.devices: Dict[str, CameraDevice] = {}
+        self.lock = threading.Lock()
+
+    def load(self):
+        configs = [{"id": "front", "name": "Ușa principală", "ip": ESP32_IP}]
+        try:
+            if os.path.exists(self.CONFIG_FILE):
+                with open(self.CONFIG_FILE, "r") as f:
+                    configs = json.load(f) or configs
         except Exception as e:
-            # Remove the saved file on error
-            try:
-                if os.path.exists(stream_path):
-                    os.remove(stream_path)
-            except Exception as cleanup_error:
-                print(f"Error cleaning up file: {cleanup_error}")
+            print(f"Error loading device config: {e}")
 
-            print(f"[❌] Stream detection error: {str(e)}")
-            return jsonify({"face_detected": False, "status": "error"}), 500
+        with self.lock:
+            for config in configs:
+                device = CameraDevice(
+                    config["id"],
+                    config.get("name", config["id"]),
+                    config["ip"],
+                    config.get("ingest_enabled", STREAM_INGEST_ENABLED),
+                    config.get("queue_quota", RECOGNITION_QUEUE_SIZE),
+                )
+                self.devices[device.id] = device
 
-    except Exception as e:
-        print(f"[❌] Stream detection request error: {str(e)}")
-        return jsonify({"face_detected": False, "status": "error"}), 500
+    def save(self):
+        try:
+            with open(self.CONFIG_FILE, "w") as f:
+                json.dump([d.to_config() for d in self.all()], f, indent=2)
+        except Exception as e:
+            print(f"Error saving device config: {e}")
+
+    def start(self):
+        for device in self.all():
+            device.start()
+
+    def all(self) -> list:
+        with self.lock:
+            return list(self.devices.values())
+
+    def get(self, device_id: Optional[str]) -> Optional[CameraDevice]:
+        with self.lock:
+            return self.devices.get(device_id)
+
+    def default(self) -> Optional[CameraDevice]:
+        with self.lock:
+            return next(iter(self.devices.values()), None)
+
+    def resolve(self, device_id: Optional[str]) -> Optional[CameraDevice]:
+        """The named device, or the default one when no name is given"""
+        return self.get(device_id) if device_id else self.default()
+
+    def find_by_ip(self, ip: str) -> Optional[CameraDevice]:
+        with self.lock:
+            return next((d for d in self.devices.values() if d.ip == ip), None)
+
+    def add(self, device: CameraDevice) -> bool:
+        with self.lock:
+            if device.id in self.devices:
+                return False
+            self.devices[device.id] = device
+        device.start()
+        self.save()
+        return True
+
+    def remove(self, device_id: str) -> bool:
+        with self.lock:
+            device = self.devices.pop(device_id, None)
+        if device is None:
+            return False
+        device.stop()
+        self.save()
+        return True
+
+
+device_registry = DeviceRegistry()
+
+
+@app.route("/api/devices", methods=["GET", "POST"])
+def devices():
+    """List cameras with their health, or register a new one"""
+    if "logged_in" not in session:
+        return jsonify({"error": "Neautentificat"}), 401
+
+    if request.method == "GET":
+        return jsonify([device.to_dict() for device in device_registry.all()])
+
+    data = request.get_json(silent=True) or {}
+    device_id = "".join(
+        c for c in data.get("id", "").strip().lower() if c.isalnum() or c in "-_"
+    )
+    ip = data.get("ip", "").strip()
+    if not device_id or not ip:
+        return jsonify({"success": False, "message": "ID și IP sunt obligatorii"}), 400
+
+    device = CameraDevice(device_id, data.get("name", "").strip() or device_id, ip)
+    if not device_registry.add(device):
+        return jsonify({"success": False, "message": "Camera există deja"}), 409
+
+    print(f"[📡] Cameră adăugată: {device_id} ({ip})")
+    return jsonify({"success": True, "device": device.to_dict()}), 201
+
+
+@app.route("/api/devices/<device_id>", methods=["DELETE"])
+def delete_device(device_id):
+    if "logged_in" not in session:
+        return jsonify({"error": "Neautentificat"}), 401
+
+    if len(device_registry.all()) <= 1:
+        return jsonify({"success": False, "message": "Ultima cameră nu poate fi ștearsă"}), 400
+    if not device_registry.remove(device_id):
+        return jsonify({"success": False, "message": "Camera nu există"}), 404
+
+    print(f"[📡] Cameră ștearsă: {device_id}")
+    return jsonify({"success": True})
+
+
+@app.route("/api/stream-ingest", methods=["GET", "POST"])
+def stream_ingest_status():
+    """Status of server-side stream detection; POST {"enabled": bool} toggles it
+
+    ?device=<id> (or "device" in the POST body) limits it to one camera;
+    otherwise the toggle applies to all of them.
+    """
+    if "logged_in" not in session:
+        return jsonify({"error": "Neautentificat"}), 401
+
+    data = request.get_json(silent=True) or {}
+    device_id = data.get("device") or request.args.get("device")
+    targets = [device_registry.get(device_id)] if device_id else device_registry.all()
+    if None in targets:
+        return jsonify({"error": "Camera nu există"}), 404
+
+    if request.method == "POST":
+        enabled = bool(data.get("enabled"))
+        for device in targets:
+            device.ingest.set_enabled(enabled)
+        device_registry.save()
+        print(f"[🎥] Detectare pe stream {'activată' if enabled else 'dezactivată'}")
+
+    statuses = {device.id: device.ingest.status() for device in targets}
+    return jsonify(
+        {
+            "enabled": any(status["enabled"] for status in statuses.values()),
+            "devices": statuses,
+        }
+    )
 
 
 def door_controller_callback():
@@ -994,14 +2348,35 @@ def door_controller_callback():
         return {"success": False, "message": f"SSE error: {str(e)}"}
 
 
-print(f"[📱] Setting door controller callback...")
-telegram_bot.set_door_controller(door_controller_callback)
+def start_background_services():
+    print(f"[🧠] Building known-face index...")
+    face_index.build()
+
+    print(f"[🧠] Starting recognition worker...")
+    recognition_worker.start()
+
+    print(f"[📡] Starting camera pipelines...")
+    device_registry.load()
+    device_registry.start()
+
+    print(f"[📱] Setting door controller callback...")
+    telegram_bot.set_door_controller(door_controller_callback)
+
+    # Start command listener
+    print(f"[📱] Starting Telegram command listener...")
+    telegram_bot.start_command_listener()
+    print(f"[📱] Telegram bot initialization complete")
+
 
-# Start command listener
-print(f"[📱] Starting Telegram command listener...")
-telegram_bot.start_command_listener()
-print(f"[📱] Telegram bot initialization complete")
+# With debug=True the Werkzeug reloader imports this module twice: once in the
+# watcher process and once in the child that serves requests. Only the child
+# (or a WSGI server importing the app) may start the ingest and worker threads,
+# otherwise every camera is read and recognized twice.
+if __name__ != "__main__" or os.environ.get("WERKZEUG_RUN_MAIN") == "true":
+    start_background_services()
 
 
 if __name__ == "__main__":
+    # HTTP/1.1 lets the ESP32 keep its upload connection open between events
+    WSGIRequestHandler.protocol_version = "HTTP/1.1"
     app.run(host="0.0.0.0", port=5000, debug=True, threaded=True)
@@ -3,8 +3,18 @@
 #include <HTTPClient.h>
 #include <WebServer.h>
 #include <esp_http_server.h>
+#include <Preferences.h>
 #include "soc/soc.h"
 #include "soc/rtc_cntl_reg.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "img_converters.h"
+#include "esp_sleep.h"
+#include "driver/rtc_io.h"
+#include "lwip/sockets.h"
+#include <atomic>
 
 // Define LED, button, buzzer, and relay pins
 #define FLASH_LED_PIN 4
@@ -19,129 +29,2501 @@
 const char *ssid = "DEMOLATORII";
 const char *password = "wintertime";
 
+// WiFi connection management, driven from loop()
+enum WifiState
+{
+    WIFI_FAST_CONNECT, // cached BSSID/channel and static IP, no scan, no DHCP
+    WIFI_FULL_CONNECT, // regular scan + DHCP, refreshes the cache
+    WIFI_CONNECTED,
+    WIFI_BACKOFF
+};
+WifiState wifiState = WIFI_FULL_CONNECT;
+unsigned long wifiStateStart = 0;
+unsigned long wifiBackoffMs = 0;
+uint32_t wifiReconnects = 0;
+const unsigned long WIFI_FAST_TIMEOUT_MS = 3000;
+const unsigned long WIFI_FULL_TIMEOUT_MS = 15000;
+const unsigned long WIFI_BACKOFF_MIN_MS = 1000;
+const unsigned long WIFI_BACKOFF_MAX_MS = 30000;
+
 // Timing and state management
 unsigned long relayStartTime = 0;
 bool relayActive = false;
+
+// Door actuation runs as a state machine in loop(); handlers only post requests
+enum DoorState
+{
+    DOOR_IDLE,
+    DOOR_UNLOCKING, // buzzer + relay on, waiting before the flash LED
+    DOOR_OPEN       // relay held for RELAY_DURATION
+};
+DoorState doorState = DOOR_IDLE;
+unsigned long doorStateStart = 0;
+std::atomic<bool> doorOpenRequested(false);
 unsigned long lastButtonPress = 0;
 const unsigned long BUTTON_DEBOUNCE = 2000;
+int lastButtonState = HIGH;
 
 // Performance settings
 const unsigned long STREAM_DELAY_MS = 50; // ~20-30 FPS max
 const unsigned long RELAY_DURATION = 3000;
+const unsigned long DOOR_UNLOCK_DELAY = 1000; // buzzer/relay lead before the flash LED
+
+// Adaptive streaming: tune frame delay and JPEG quality from send backpressure
+const bool ADAPTIVE_STREAM_ENABLED = true;
+const uint32_t ADAPT_TARGET_SEND_US = 40000; // per-frame send time we aim for
+const uint32_t ADAPT_MAX_KBPS = 0;           // optional bitrate cap, 0 = off
+const unsigned long ADAPT_INTERVAL_MS = 1000;
+const unsigned long ADAPT_MIN_DELAY_MS = 10;
+const unsigned long ADAPT_MAX_DELAY_MS = 500;
+const int ADAPT_QUALITY_MAX = 40; // worst JPEG quality the controller may pick
+
+// Motion detection: 1/8-scale luma frame difference, checked a few times a second
+#define MOTION_BLOCK 8
+const bool MOTION_DETECT_ENABLED = true;
+const unsigned long MOTION_INTERVAL_MS = 250;
+const uint32_t MOTION_PIXEL_DELTA = 12; // mean absolute luma change for a block to count
+const int MOTION_MIN_BLOCKS = 3;
+const unsigned long MOTION_COOLDOWN_MS = 10000;
+
+struct MotionBox
+{
+    int x0, y0, x1, y1; // in full frame pixels, valid when x1 > x0
+};
+
+volatile bool motionEnabled = MOTION_DETECT_ENABLED;
+volatile int motionChangedBlocks = 0;
+volatile uint32_t motionEvents = 0;
+volatile unsigned long lastMotionTime = 0;
+MotionBox motionBox = {0, 0, 0, 0}; // last moving region, guarded by motionMux with its time
+unsigned long motionBoxTime = 0;
+portMUX_TYPE motionMux = portMUX_INITIALIZER_UNLOCKED;
 
 // Server endpoint
 const char *serverUrl = "http://192.168.0.103:5000/upload";
 httpd_handle_t camera_httpd = NULL;
+httpd_handle_t stream_httpd = NULL;
+
+// Control/API traffic and MJPEG streaming run on separate httpd instances.
+// Camera work is pinned to the APP core; control stays next to the WiFi stack.
+#define CONTROL_PORT 80
+#define STREAM_PORT 81
+#define CAMERA_CORE 1
+#define CONTROL_CORE 0
+#define CONTROL_HTTPD_PRIORITY 7 // above every camera task so /control never queues behind frames
+#define STREAM_HTTPD_PRIORITY 5
+
+// Device-side uploads: trigger bits passed to the upload task. They live in an
+// event group because the task's notification value carries frame deliveries.
+#define UPLOAD_TRIGGER_BUTTON (1 << 0)
+#define UPLOAD_TRIGGER_MOTION (1 << 1)
+#define UPLOAD_TRIGGER_ALL (UPLOAD_TRIGGER_BUTTON | UPLOAD_TRIGGER_MOTION)
+const unsigned long UPLOAD_TIMEOUT_MS = 5000;
+EventGroupHandle_t uploadTriggers = NULL;
+
+// Upload sender: one kept-alive connection drained from a bounded job queue
+#define UPLOAD_QUEUE_LENGTH 4
+const int UPLOAD_MAX_ATTEMPTS = 3;
+const unsigned long UPLOAD_BACKOFF_MIN_MS = 500;
+const unsigned long UPLOAD_BACKOFF_MAX_MS = 30000;
+QueueHandle_t uploadQueue = NULL;
+
+// Region-of-interest crop for uploads (PSRAM only)
+const int ROI_MOTION_MARGIN = 48; // pixels added around the motion box
+const unsigned long ROI_MOTION_MAX_AGE_MS = 3000; // older motion boxes no longer say where the visitor is
+const int ROI_MAX_SIDE = 480;     // larger crops are decoded at 1/2 or 1/4 scale
+const int ROI_JPEG_QUALITY = 80;  // fmt2jpg() scale, higher is better
+const size_t ROI_ARENA_BYTES = 384 * 1024; // crops of one upload, packed back to back
+volatile uint32_t roiFallbacks = 0;        // batches sent uncropped because a crop failed
+volatile uint32_t uploadsSent = 0;
+volatile uint32_t uploadsFailed = 0;
+volatile uint32_t uploadsDropped = 0;
+volatile uint32_t uploadReconnects = 0;
+
+// Pre-roll clip: recent JPEGs kept so an event upload includes the seconds before it
+#define CLIP_MAX_FRAMES 32
+const size_t CLIP_ARENA_BYTES_PSRAM = 1024 * 1024;
+const size_t CLIP_ARENA_BYTES_DRAM = 32 * 1024; // a couple of QVGA frames at most
+const unsigned long CLIP_FRAME_INTERVAL_MS = 200;
+const unsigned long CLIP_PREROLL_MS = 3000;
+const int CLIP_POSTROLL_FRAMES = 5;
+
+// Stream fan-out
+#define MAX_STREAM_CLIENTS 4
+#define MAX_WS_CLIENTS 3
+const uint32_t WS_MAX_INFLIGHT = 2;          // unacknowledged frames before a client is skipped
+const unsigned long WS_ACK_TIMEOUT_MS = 1000; // clients that never ACK still get a frame this often
+const int WS_SEND_TIMEOUT_MS = 500;           // a client whose socket stays full this long is dropped
+
+// Socket budget: lwIP has CONFIG_LWIP_MAX_SOCKETS (16 on Arduino) for everything.
+// Each httpd also holds a listening and a control socket. Streaming gets one
+// socket per client; /control, /capture, /health, /config and /bench share
+// CONTROL_MAX_SOCKETS, and the least recently used keep-alive socket is closed
+// to admit a new one. The upload client keeps one connection open. The /bench
+// loopback pair only borrows sockets that are free, and reports null otherwise.
+#define HTTPD_INTERNAL_SOCKETS 2
+#define STREAM_MAX_SOCKETS (MAX_STREAM_CLIENTS + MAX_WS_CLIENTS)
+#define CONTROL_MAX_SOCKETS 3
+#define UPLOAD_SOCKETS 1
+#if defined(CONFIG_LWIP_MAX_SOCKETS)
+static_assert(STREAM_MAX_SOCKETS + CONTROL_MAX_SOCKETS + 2 * HTTPD_INTERNAL_SOCKETS + UPLOAD_SOCKETS < CONFIG_LWIP_MAX_SOCKETS,
+              "socket budget exceeds CONFIG_LWIP_MAX_SOCKETS");
+#endif
+
+#define MAX_FRAME_SUBSCRIBERS 8
+#define FRAME_POOL_SIZE 3 // one slot per driver frame buffer, sized for the largest fb_count
+#define CAMERA_FB_COUNT_PSRAM 3
+const unsigned long STREAM_FRAME_TIMEOUT_MS = 5000;
+const int64_t FRAME_STALE_US = 200000; // single-buffer mode only: re-grab frames older than this
+const unsigned long CAPTURE_DEFAULT_MAX_AGE_MS = 200;
+
+int cameraFbCount = 1;
+camera_config_t cameraConfig; // kept for re-init when leaving idle mode
+
+// Benchmark sweep for /bench: every frame size up to cameraMaxFrameSize at each quality
+const framesize_t BENCH_FRAME_SIZES[] = {FRAMESIZE_QVGA, FRAMESIZE_VGA, FRAMESIZE_SVGA};
+const int BENCH_QUALITIES[] = {10, 20, 30};
+#define BENCH_MAX_POINTS (sizeof(BENCH_FRAME_SIZES) / sizeof(BENCH_FRAME_SIZES[0]) * sizeof(BENCH_QUALITIES) / sizeof(BENCH_QUALITIES[0]))
+const int BENCH_DEFAULT_FRAMES = 10;
+const int BENCH_MAX_FRAMES = 20;
+const int BENCH_WARMUP_FRAMES = 3;             // the sensor needs a few frames to settle after a resize
+const size_t BENCH_LOOPBACK_BYTES = 512 * 1024; // sent per point through a 127.0.0.1 socket
+const unsigned long BENCH_LOOPBACK_TIMEOUT_MS = 5000;
+
+// Idle mode: sensor powered down and WiFi in modem sleep until something happens
+const unsigned long IDLE_TIMEOUT_MS = 10 * 60 * 1000UL;
+const unsigned long IDLE_CHECK_INTERVAL_MS = 1000;
+const bool IDLE_DEEP_SLEEP = false; // battery units: deep sleep until the button instead
+volatile bool cameraAsleep = false;
+volatile unsigned long lastActivityTime = 0;
+
+// Pipeline counters, read by /health and /metrics without touching the driver
+volatile uint32_t framesCaptured = 0;
+volatile uint32_t captureFailures = 0;
+volatile int64_t lastFrameUs = 0;
+uint32_t frameSequence = 0;
+
+TaskHandle_t captureTaskHandle = NULL;
+SemaphoreHandle_t frameSlots = NULL; // free entries in framePool
+portMUX_TYPE frameMux = portMUX_INITIALIZER_UNLOCKED;
+
+// **Centralized CORS header setup**
+void setCORSHeaders(httpd_req_t *req)
+{
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Methods", "GET, POST, OPTIONS");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", "Content-Type");
+    httpd_resp_set_hdr(req, "Access-Control-Expose-Headers", "X-Frame-Seq, X-Frame-Timestamp, X-Device-Time");
+}
+
+// **Hot-path latency histograms**
+// Fixed log2 buckets updated with relaxed atomics: no locks and no heap
+// allocation per frame. Bucket i counts samples below 2^(i+7) us, the last
+// bucket everything slower. sum_us wraps; reset with /metrics?reset=1.
+#define LATENCY_BUCKETS 14
+
+enum LatencyStage
+{
+    LAT_FB_GET,
+    LAT_JPEG_ENCODE,
+    LAT_STREAM_HEADER,
+    LAT_STREAM_BODY,
+    LAT_STREAM_FRAME,
+    LAT_CAPTURE_SEND,
+    LAT_WS_FRAME,
+    LAT_STAGE_COUNT
+};
+
+const char *const LATENCY_STAGE_NAMES[LAT_STAGE_COUNT] = {
+    "fb_get", "jpeg_encode", "stream_header", "stream_body", "stream_frame", "capture_send", "ws_frame"};
+
+struct LatencyHistogram
+{
+    std::atomic<uint32_t> buckets[LATENCY_BUCKETS];
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> sum_us;
+    std::atomic<uint32_t> max_us;
+};
 
-// ** Centralized camera buffer flushing**
-void flushCameraBuffer()
+LatencyHistogram latencyStats[LAT_STAGE_COUNT];
+
+void latencyRecord(LatencyStage stage, int64_t elapsedUs)
 {
-    for (int i = 0; i < 2; i++)
+    LatencyHistogram &h = latencyStats[stage];
+    uint32_t us = elapsedUs > 0 ? (uint32_t)elapsedUs : 0;
+
+    int bucket = 0;
+    if (us >= 128)
     {
-        camera_fb_t *flush_fb = esp_camera_fb_get();
-        if (flush_fb)
+        bucket = (31 - __builtin_clz(us)) - 6;
+        if (bucket >= LATENCY_BUCKETS)
         {
-            esp_camera_fb_return(flush_fb);
+            bucket = LATENCY_BUCKETS - 1;
         }
     }
+
+    h.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    h.count.fetch_add(1, std::memory_order_relaxed);
+    h.sum_us.fetch_add(us, std::memory_order_relaxed);
+
+    uint32_t prev = h.max_us.load(std::memory_order_relaxed);
+    while (us > prev && !h.max_us.compare_exchange_weak(prev, us, std::memory_order_relaxed))
+    {
+    }
 }
 
-// **Centralized CORS header setup**
-void setCORSHeaders(httpd_req_t *req)
+void latencyReset()
 {
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Methods", "GET, POST, OPTIONS");
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Headers", "Content-Type");
+    for (int s = 0; s < LAT_STAGE_COUNT; s++)
+    {
+        for (int i = 0; i < LATENCY_BUCKETS; i++)
+        {
+            latencyStats[s].buckets[i].store(0, std::memory_order_relaxed);
+        }
+        latencyStats[s].count.store(0, std::memory_order_relaxed);
+        latencyStats[s].sum_us.store(0, std::memory_order_relaxed);
+        latencyStats[s].max_us.store(0, std::memory_order_relaxed);
+    }
 }
 
-// **Improved stream handler with frame rate control**
-static esp_err_t stream_handler(httpd_req_t *req)
+// **Adaptive frame rate / quality controller**
+// Stream clients report each frame's send time and size; the capture task
+// periodically moves the inter-frame delay and sensor JPEG quality so the
+// smoothed send time stays near ADAPT_TARGET_SEND_US.
+struct AdaptiveState
 {
-    camera_fb_t *fb = NULL;
-    esp_err_t res = ESP_OK;
-    size_t _jpg_buf_len = 0;
-    uint8_t *_jpg_buf = NULL;
-    char part_buf[128];
+    bool enabled;
+    unsigned long frameDelayMs;
+    unsigned long minDelayMs; // raised by the /config FPS cap
+    int baseQuality; // quality chosen at boot; never go better than this
+    int quality;
+    int32_t sendEwmaUs;
+    int32_t bytesEwma;
+    uint32_t samples;       // total, 0 seeds the averages
+    uint32_t windowSamples; // since the last adjustment
+    unsigned long lastUpdate;
+};
 
-    setCORSHeaders(req);
+AdaptiveState adaptive = {ADAPTIVE_STREAM_ENABLED, STREAM_DELAY_MS, ADAPT_MIN_DELAY_MS, 0, 0, 0, 0, 0, 0, 0};
+portMUX_TYPE adaptiveMux = portMUX_INITIALIZER_UNLOCKED;
+
+void adaptiveReportSend(int64_t sendUs, size_t bytes)
+{
+    portENTER_CRITICAL(&adaptiveMux);
+    if (adaptive.samples == 0)
+    {
+        adaptive.sendEwmaUs = (int32_t)sendUs;
+        adaptive.bytesEwma = (int32_t)bytes;
+    }
+    else
+    {
+        adaptive.sendEwmaUs += ((int32_t)sendUs - adaptive.sendEwmaUs) / 8;
+        adaptive.bytesEwma += ((int32_t)bytes - adaptive.bytesEwma) / 8;
+    }
+    adaptive.samples++;
+    adaptive.windowSamples++;
+    portEXIT_CRITICAL(&adaptiveMux);
+}
+
+// Called from the capture task between frames, so sensor writes never race a grab
+void adaptiveUpdate()
+{
+    unsigned long now = millis();
+    if (!adaptive.enabled || now - adaptive.lastUpdate < ADAPT_INTERVAL_MS)
+    {
+        return;
+    }
+    adaptive.lastUpdate = now;
+
+    portENTER_CRITICAL(&adaptiveMux);
+    uint32_t samples = adaptive.windowSamples;
+    int32_t sendUs = adaptive.sendEwmaUs;
+    int32_t bytes = adaptive.bytesEwma;
+    adaptive.windowSamples = 0;
+    portEXIT_CRITICAL(&adaptiveMux);
+
+    if (samples == 0)
+    {
+        return;
+    }
+
+    unsigned long delayMs = adaptive.frameDelayMs;
+    int quality = adaptive.quality;
+    uint32_t kbps = (uint32_t)bytes * 8 / (delayMs + sendUs / 1000 + 1);
+    bool overBitrate = ADAPT_MAX_KBPS && kbps > ADAPT_MAX_KBPS;
+
+    if (sendUs > (int32_t)(ADAPT_TARGET_SEND_US * 5 / 4) || overBitrate)
+    {
+        // Backpressure: slow down first, then trade image quality for bytes
+        if (delayMs < ADAPT_MAX_DELAY_MS)
+        {
+            delayMs = min(ADAPT_MAX_DELAY_MS, delayMs + delayMs / 4 + 5);
+        }
+        if ((delayMs >= ADAPT_MAX_DELAY_MS || sendUs > (int32_t)ADAPT_TARGET_SEND_US * 2 || overBitrate) &&
+            quality < ADAPT_QUALITY_MAX)
+        {
+            quality = min(ADAPT_QUALITY_MAX, quality + 2);
+        }
+    }
+    else if (sendUs < (int32_t)(ADAPT_TARGET_SEND_US * 3 / 5))
+    {
+        // Headroom: win back quality before frame rate
+        if (quality > adaptive.baseQuality)
+        {
+            quality--;
+        }
+        else if (delayMs > adaptive.minDelayMs)
+        {
+            delayMs = max(adaptive.minDelayMs, delayMs - delayMs / 10 - 1);
+        }
+    }
+
+    if (quality != adaptive.quality)
+    {
+        sensor_t *sensor = esp_camera_sensor_get();
+        if (sensor && sensor->set_quality(sensor, quality) == 0)
+        {
+            adaptive.quality = quality;
+        }
+    }
+    adaptive.frameDelayMs = delayMs;
+}
+
+// **Runtime camera settings (/config), persisted in NVS**
+// The handler only stages a new settings block; the capture task applies it
+// between frames so a grab never sees a half-applied sensor state.
+enum RoiMode
+{
+    ROI_OFF,
+    ROI_RECT,  // fixed rectangle around the doorway
+    ROI_MOTION // bounding box of the last motion, else the full frame
+};
+
+struct RoiRect
+{
+    int x;
+    int y;
+    int w;
+    int h;
+};
+
+struct CameraSettings
+{
+    framesize_t frameSize;
+    int quality;    // 10 (best) .. 63
+    int xclkMhz;
+    int brightness; // -2 .. 2
+    int gain;       // 0 .. 30, or -1 for automatic gain
+    int fpsCap;     // 0 = no cap beyond STREAM_DELAY_MS
+    bool adaptive;
+    bool motion;    // on-device motion detector gates uploads
+    RoiMode roiMode; // uploads only: the stream always carries the full frame
+    RoiRect roi;     // full-resolution pixels, used by ROI_RECT
+};
+
+struct FrameSizeName
+{
+    const char *name;
+    framesize_t size;
+};
+
+const FrameSizeName FRAME_SIZE_NAMES[] = {
+    {"QQVGA", FRAMESIZE_QQVGA}, {"QVGA", FRAMESIZE_QVGA}, {"CIF", FRAMESIZE_CIF},
+    {"HVGA", FRAMESIZE_HVGA},   {"VGA", FRAMESIZE_VGA},   {"SVGA", FRAMESIZE_SVGA},
+    {"XGA", FRAMESIZE_XGA},     {"SXGA", FRAMESIZE_SXGA}, {"UXGA", FRAMESIZE_UXGA}};
+
+CameraSettings cameraSettings;
+CameraSettings pendingSettings;
+volatile bool settingsPending = false;
+framesize_t cameraMaxFrameSize = FRAMESIZE_QVGA; // largest size the buffers were allocated for
+portMUX_TYPE settingsMux = portMUX_INITIALIZER_UNLOCKED;
+Preferences cameraPrefs;
+
+const char *frameSizeName(framesize_t size)
+{
+    for (const FrameSizeName &entry : FRAME_SIZE_NAMES)
+    {
+        if (entry.size == size)
+        {
+            return entry.name;
+        }
+    }
+    return "UNKNOWN";
+}
+
+bool parseFrameSize(const char *name, framesize_t *size)
+{
+    for (const FrameSizeName &entry : FRAME_SIZE_NAMES)
+    {
+        if (strcasecmp(entry.name, name) == 0)
+        {
+            *size = entry.size;
+            return true;
+        }
+    }
+    return false;
+}
+
+void cameraSettingsLoad(CameraSettings *settings, bool psram)
+{
+    cameraPrefs.begin("camera", true);
+    settings->frameSize = (framesize_t)cameraPrefs.getUChar("fsize", psram ? FRAMESIZE_VGA : FRAMESIZE_QVGA);
+    settings->quality = cameraPrefs.getUChar("quality", psram ? 15 : 20);
+    settings->xclkMhz = cameraPrefs.getUChar("xclk", 20);
+    settings->brightness = cameraPrefs.getChar("bright", 0);
+    settings->gain = cameraPrefs.getChar("gain", -1);
+    settings->fpsCap = cameraPrefs.getUChar("fps", 0);
+    settings->adaptive = cameraPrefs.getBool("adaptive", ADAPTIVE_STREAM_ENABLED);
+    settings->motion = cameraPrefs.getBool("motion", MOTION_DETECT_ENABLED);
+    settings->roiMode = (RoiMode)cameraPrefs.getUChar("roi", ROI_OFF);
+    settings->roi.x = cameraPrefs.getUShort("roi_x", 0);
+    settings->roi.y = cameraPrefs.getUShort("roi_y", 0);
+    settings->roi.w = cameraPrefs.getUShort("roi_w", 0);
+    settings->roi.h = cameraPrefs.getUShort("roi_h", 0);
+    cameraPrefs.end();
+
+    if (settings->frameSize > cameraMaxFrameSize)
+    {
+        settings->frameSize = cameraMaxFrameSize;
+    }
+}
+
+void cameraSettingsSave(const CameraSettings &settings)
+{
+    cameraPrefs.begin("camera", false);
+    cameraPrefs.putUChar("fsize", settings.frameSize);
+    cameraPrefs.putUChar("quality", settings.quality);
+    cameraPrefs.putUChar("xclk", settings.xclkMhz);
+    cameraPrefs.putChar("bright", settings.brightness);
+    cameraPrefs.putChar("gain", settings.gain);
+    cameraPrefs.putUChar("fps", settings.fpsCap);
+    cameraPrefs.putBool("adaptive", settings.adaptive);
+    cameraPrefs.putBool("motion", settings.motion);
+    cameraPrefs.putUChar("roi", settings.roiMode);
+    cameraPrefs.putUShort("roi_x", settings.roi.x);
+    cameraPrefs.putUShort("roi_y", settings.roi.y);
+    cameraPrefs.putUShort("roi_w", settings.roi.w);
+    cameraPrefs.putUShort("roi_h", settings.roi.h);
+    cameraPrefs.end();
+}
+
+// Push settings to the sensor; only call from the capture task or before it starts
+// (the /bench task drives the sensor directly, but only while the capture task is parked)
+void cameraApplySettings(const CameraSettings &settings)
+{
+    sensor_t *sensor = esp_camera_sensor_get();
+    if (!sensor)
+    {
+        return;
+    }
+
+    if (settings.xclkMhz != cameraSettings.xclkMhz)
+    {
+        sensor->set_xclk(sensor, LEDC_TIMER_0, settings.xclkMhz);
+    }
+    sensor->set_framesize(sensor, settings.frameSize);
+    sensor->set_quality(sensor, settings.quality);
+    sensor->set_brightness(sensor, settings.brightness);
+    if (settings.gain < 0)
+    {
+        sensor->set_gain_ctrl(sensor, 1);
+    }
+    else
+    {
+        sensor->set_gain_ctrl(sensor, 0);
+        sensor->set_agc_gain(sensor, settings.gain);
+    }
+
+    unsigned long capDelayMs = settings.fpsCap ? 1000 / settings.fpsCap : 0;
+    adaptive.enabled = settings.adaptive;
+    adaptive.baseQuality = settings.quality;
+    adaptive.quality = settings.quality;
+    adaptive.minDelayMs = max(ADAPT_MIN_DELAY_MS, capDelayMs);
+    adaptive.frameDelayMs = max(STREAM_DELAY_MS, capDelayMs);
+    motionEnabled = settings.motion;
+
+    // Other tasks copy cameraSettings (ROI included) under the same lock
+    portENTER_CRITICAL(&settingsMux);
+    cameraSettings = settings;
+    portEXIT_CRITICAL(&settingsMux);
+}
+
+void cameraApplyPendingSettings()
+{
+    CameraSettings settings;
+
+    portENTER_CRITICAL(&settingsMux);
+    settings = pendingSettings;
+    settingsPending = false;
+    portEXIT_CRITICAL(&settingsMux);
+
+    cameraApplySettings(settings);
+    Serial.printf("Camera settings applied: %s q=%d\n", frameSizeName(settings.frameSize), settings.quality);
+}
+
+// **Shared frame pipeline**
+// One capture task grabs each frame once and hands the same buffer to every
+// subscriber. A frame goes back to the driver when its last reference drops.
+// With PSRAM the pool is a ring of up to fb_count frames, so the sensor fills
+// the next buffer while earlier ones are still being sent.
+struct SharedFrame
+{
+    camera_fb_t *fb;
+    uint8_t *buf; // fb->buf, or a frame2jpg() copy for non-JPEG formats
+    size_t len;
+    int64_t timestamp_us; // esp_timer time at capture
+    uint32_t seq;         // monotonic capture sequence number
+    uint32_t refs;
+};
+
+// Each subscriber has a one-slot mailbox: a newer frame replaces one the
+// subscriber has not picked up yet, so a slow client only ever misses stale
+// frames and never holds up the capture task or the other clients.
+struct FrameSubscriber
+{
+    TaskHandle_t task;
+    SharedFrame *pending; // next frame to send, owned by the subscriber
+    uint32_t delivered;
+    uint32_t dropped;
+};
+
+struct StreamClient
+{
+    FrameSubscriber sub;
+    httpd_req_t *req;
+};
+
+SharedFrame framePool[FRAME_POOL_SIZE];
+SharedFrame *latestFrame = NULL; // newest frame, retained only when fb_count > 1
+FrameSubscriber *frameSubscribers[MAX_FRAME_SUBSCRIBERS];
+volatile int frameSubscriberCount = 0;
+StreamClient streamClients[MAX_STREAM_CLIENTS];
+
+void frameRelease(SharedFrame *frame)
+{
+    portENTER_CRITICAL(&frameMux);
+    bool last = (--frame->refs == 0);
+    portEXIT_CRITICAL(&frameMux);
+
+    if (!last)
+    {
+        return;
+    }
+
+    if (frame->buf != frame->fb->buf)
+    {
+        free(frame->buf);
+    }
+    esp_camera_fb_return(frame->fb);
+    frame->fb = NULL;
+    frame->buf = NULL;
+    frame->len = 0;
+
+    xSemaphoreGive(frameSlots);
+}
+
+bool frameSubscribe(FrameSubscriber *sub)
+{
+    bool added = false;
+
+    sub->task = xTaskGetCurrentTaskHandle();
+    sub->pending = NULL;
+    sub->delivered = 0;
+    sub->dropped = 0;
+
+    portENTER_CRITICAL(&frameMux);
+    for (int i = 0; i < MAX_FRAME_SUBSCRIBERS; i++)
+    {
+        if (frameSubscribers[i] == NULL)
+        {
+            frameSubscribers[i] = sub;
+            frameSubscriberCount++;
+            added = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&frameMux);
+
+    // Wake the capture task in case it was idle without subscribers
+    if (added && captureTaskHandle)
+    {
+        xTaskNotifyGive(captureTaskHandle);
+    }
+    return added;
+}
+
+void frameUnsubscribe(FrameSubscriber *sub)
+{
+    SharedFrame *pending = NULL;
+
+    portENTER_CRITICAL(&frameMux);
+    for (int i = 0; i < MAX_FRAME_SUBSCRIBERS; i++)
+    {
+        if (frameSubscribers[i] == sub)
+        {
+            frameSubscribers[i] = NULL;
+            frameSubscriberCount--;
+            break;
+        }
+    }
+    pending = sub->pending;
+    sub->pending = NULL;
+    portEXIT_CRITICAL(&frameMux);
+
+    if (pending)
+    {
+        frameRelease(pending);
+    }
+}
+
+// Wait for the next frame delivered to this subscriber. The caller owns one
+// reference to the returned frame and must hand it back with frameRelease().
+SharedFrame *frameTake(FrameSubscriber *sub, TickType_t timeout)
+{
+    SharedFrame *frame = NULL;
+    TickType_t start = xTaskGetTickCount();
+
+    while (true)
+    {
+        portENTER_CRITICAL(&frameMux);
+        frame = sub->pending;
+        sub->pending = NULL;
+        if (frame)
+        {
+            sub->delivered++;
+        }
+        portEXIT_CRITICAL(&frameMux);
+
+        if (frame)
+        {
+            return frame;
+        }
+
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= timeout)
+        {
+            return NULL;
+        }
+        ulTaskNotifyTake(pdTRUE, timeout - waited);
+    }
+}
+
+// Reference the cached newest frame if it is at most maxAgeUs old
+SharedFrame *frameAcquireLatest(int64_t maxAgeUs)
+{
+    SharedFrame *frame = NULL;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&frameMux);
+    if (latestFrame && now - latestFrame->timestamp_us <= maxAgeUs)
+    {
+        frame = latestFrame;
+        frame->refs++;
+    }
+    portEXIT_CRITICAL(&frameMux);
+
+    return frame;
+}
+
+// Newest frame no older than maxAgeMs, waiting for the next capture if needed
+SharedFrame *frameGetFresh(unsigned long maxAgeMs)
+{
+    SharedFrame *frame = frameAcquireLatest((int64_t)maxAgeMs * 1000);
+    if (!frame)
+    {
+        FrameSubscriber sub;
+        if (frameSubscribe(&sub))
+        {
+            frame = frameTake(&sub, pdMS_TO_TICKS(STREAM_FRAME_TIMEOUT_MS));
+            frameUnsubscribe(&sub);
+        }
+    }
+    return frame;
+}
+
+// **Idle mode**
+// After IDLE_TIMEOUT_MS without a viewer, request, button press or motion
+// the capture task deinitializes the camera, holds the sensor in power-down
+// and lets WiFi sleep between beacons. Only the capture task touches the
+// driver, so sleep and wake happen there, between frames. Background
+// consumers (motion, pre-roll) pause while the camera sleeps; anything that
+// calls noteActivity() wakes it on its next frame request.
+void noteActivity()
+{
+    lastActivityTime = millis();
+    if (cameraAsleep && captureTaskHandle)
+    {
+        xTaskNotifyGive(captureTaskHandle);
+    }
+}
+
+bool cameraIdle()
+{
+    return millis() - lastActivityTime >= IDLE_TIMEOUT_MS;
+}
+
+// Only call from the capture task, with no subscribers
+void cameraSleep()
+{
+    // Drop the retained frame so every buffer can go back to the driver
+    SharedFrame *previous = NULL;
+    portENTER_CRITICAL(&frameMux);
+    previous = latestFrame;
+    latestFrame = NULL;
+    portEXIT_CRITICAL(&frameMux);
+    if (previous)
+    {
+        frameRelease(previous);
+    }
+    if ((int)uxSemaphoreGetCount(frameSlots) < cameraFbCount)
+    {
+        return; // a frame is still out, try again on the next check
+    }
+
+    esp_camera_deinit();
+    if (PWDN_GPIO_NUM >= 0)
+    {
+        pinMode(PWDN_GPIO_NUM, OUTPUT);
+        digitalWrite(PWDN_GPIO_NUM, HIGH);
+    }
+    WiFi.setSleep(WIFI_PS_MAX_MODEM);
+    cameraAsleep = true;
+    Serial.println("Idle: camera powered down");
+}
+
+// Re-init brings the sensor out of power-down; the saved settings go back on top
+bool cameraWake()
+{
+    int64_t start = esp_timer_get_time();
+    WiFi.setSleep(WIFI_PS_MIN_MODEM);
+    cameraConfig.xclk_freq_hz = cameraSettings.xclkMhz * 1000000;
+    cameraConfig.jpeg_quality = cameraSettings.quality;
+    if (esp_camera_init(&cameraConfig) != ESP_OK)
+    {
+        Serial.println("Camera re-init failed");
+        return false;
+    }
+    cameraApplySettings(cameraSettings);
+    cameraAsleep = false;
+    Serial.printf("Camera resumed in %lld ms\n", (esp_timer_get_time() - start) / 1000);
+    return true;
+}
+
+// Battery units: nothing else can wake us, so park the relay and wait for the button
+void enterDeepSleep()
+{
+    Serial.println("Idle: entering deep sleep until the doorbell button");
+    digitalWrite(RELAY_PIN, LOW);
+    gpio_hold_en((gpio_num_t)RELAY_PIN);
+    gpio_deep_sleep_hold_en();
+    rtc_gpio_pullup_en((gpio_num_t)BUTTON_PIN);
+    esp_sleep_enable_ext0_wakeup((gpio_num_t)BUTTON_PIN, 0);
+    esp_deep_sleep_start();
+}
+
+// **Benchmark: /bench borrows the sensor from the capture task**
+// The capture task parks with every frame buffer returned to the driver, the
+// bench task sweeps sizes and qualities on the bare driver, then hands the
+// sensor back and the capture task restores cameraSettings.
+struct BenchResult
+{
+    framesize_t size;
+    int quality;
+    int frames;
+    float fps;          // -1 if fewer than two frames arrived
+    uint32_t avgBytes;
+    int64_t encodeUs;   // frame2jpg() time, -1 if not measured
+    uint32_t loopbackKBps; // 0 if the loopback socket was unavailable
+};
+
+BenchResult benchResults[BENCH_MAX_POINTS];
+int benchResultCount = 0;
+int benchFrames = BENCH_DEFAULT_FRAMES;
+httpd_req_t *benchReq = NULL;
+volatile bool benchActive = false;    // a /bench request is running; only the control httpd sets it
+volatile bool benchRequested = false; // the bench task wants the sensor
+bool benchCameraReady = false;
+SemaphoreHandle_t benchParked = NULL;
+SemaphoreHandle_t benchResume = NULL;
+volatile size_t benchSinkBytes = 0;
+
+// Capture task side: return everything to the driver and wait for the bench to finish
+void benchPark()
+{
+    bool awake = !cameraAsleep || cameraWake();
+
+    SharedFrame *previous = NULL;
+    portENTER_CRITICAL(&frameMux);
+    previous = latestFrame;
+    latestFrame = NULL;
+    portEXIT_CRITICAL(&frameMux);
+    if (previous)
+    {
+        frameRelease(previous);
+    }
+
+    // Subscribers hand their frames back within one send timeout
+    int held = 0;
+    while (held < cameraFbCount && xSemaphoreTake(frameSlots, pdMS_TO_TICKS(STREAM_FRAME_TIMEOUT_MS)) == pdTRUE)
+    {
+        held++;
+    }
+
+    benchCameraReady = awake && held == cameraFbCount;
+    xSemaphoreGive(benchParked);
+    xSemaphoreTake(benchResume, portMAX_DELAY);
+
+    while (held-- > 0)
+    {
+        xSemaphoreGive(frameSlots);
+    }
+    if (!cameraAsleep)
+    {
+        cameraApplySettings(cameraSettings);
+    }
+}
+
+// Reads whatever the bench sends over loopback until the sender closes
+static void bench_sink_task(void *arg)
+{
+    int listenFd = (int)(intptr_t)arg;
+    uint8_t buf[1024];
+
+    int fd = accept(listenFd, NULL, NULL);
+    while (fd >= 0)
+    {
+        int n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+        {
+            break;
+        }
+        benchSinkBytes += n;
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    vTaskDelete(NULL);
+}
+
+// Connects a socket to a sink task on 127.0.0.1; returns the sending fd or -1
+int benchLoopbackOpen(int *listenFd)
+{
+    struct sockaddr_in addr = {};
+    socklen_t addrLen = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    *listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (*listenFd < 0)
+    {
+        return -1;
+    }
+    if (bind(*listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(*listenFd, 1) != 0 ||
+        getsockname(*listenFd, (struct sockaddr *)&addr, &addrLen) != 0 ||
+        xTaskCreatePinnedToCore(bench_sink_task, "bench_sink", 3072, (void *)(intptr_t)*listenFd, 4, NULL,
+                                CONTROL_CORE) != pdPASS)
+    {
+        close(*listenFd);
+        *listenFd = -1;
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0)
+    {
+        // The sink is still blocked in accept(); closing the listener releases it
+        close(*listenFd);
+        *listenFd = -1;
+    }
+    return fd;
+}
+
+// Push BENCH_LOOPBACK_BYTES of a real frame through the TCP stack and time its delivery
+uint32_t benchLoopbackSend(int fd, const uint8_t *buf, size_t len)
+{
+    size_t target = benchSinkBytes + BENCH_LOOPBACK_BYTES;
+    size_t sent = 0;
+    int64_t start = esp_timer_get_time();
+
+    while (sent < BENCH_LOOPBACK_BYTES)
+    {
+        size_t offset = sent % len;
+        size_t chunk = min(len - offset, BENCH_LOOPBACK_BYTES - sent);
+        int n = send(fd, buf + offset, chunk, 0);
+        if (n <= 0)
+        {
+            return 0;
+        }
+        sent += n;
+    }
+
+    unsigned long deadline = millis() + BENCH_LOOPBACK_TIMEOUT_MS;
+    while (benchSinkBytes < target && (long)(deadline - millis()) > 0)
+    {
+        vTaskDelay(1);
+    }
+    int64_t elapsedUs = esp_timer_get_time() - start;
+    if (benchSinkBytes < target || elapsedUs <= 0)
+    {
+        return 0;
+    }
+    return (uint32_t)(BENCH_LOOPBACK_BYTES * 1000000LL / elapsedUs / 1024);
+}
+
+// Times frame2jpg() on a frame; JPEG frames are decoded to RGB565 first so the
+// number shows what a raw-format sensor would cost per frame
+int64_t benchEncode(camera_fb_t *fb, uint8_t *rgbBuf)
+{
+    camera_fb_t raw;
+    camera_fb_t *input = fb;
+
+    if (fb->format == PIXFORMAT_JPEG)
+    {
+        if (!rgbBuf || !jpg2rgb565(fb->buf, fb->len, rgbBuf, JPG_SCALE_NONE))
+        {
+            return -1;
+        }
+        raw = *fb;
+        raw.buf = rgbBuf;
+        raw.len = fb->width * fb->height * 2;
+        raw.format = PIXFORMAT_RGB565;
+        input = &raw;
+    }
+
+    uint8_t *out = NULL;
+    size_t outLen = 0;
+    int64_t start = esp_timer_get_time();
+    bool converted = frame2jpg(input, 80, &out, &outLen);
+    int64_t elapsed = esp_timer_get_time() - start;
+    free(out);
+    return converted ? elapsed : -1;
+}
+
+void benchSweep()
+{
+    sensor_t *sensor = esp_camera_sensor_get();
+    uint8_t *rgbBuf = psramFound()
+                          ? (uint8_t *)ps_malloc(resolution[cameraMaxFrameSize].width * resolution[cameraMaxFrameSize].height * 2)
+                          : NULL;
+    int listenFd = -1;
+    int loopFd = benchLoopbackOpen(&listenFd);
+
+    benchResultCount = 0;
+    for (framesize_t size : BENCH_FRAME_SIZES)
+    {
+        if (size > cameraMaxFrameSize)
+        {
+            continue; // buffers were allocated for smaller frames
+        }
+        for (int quality : BENCH_QUALITIES)
+        {
+            sensor->set_framesize(sensor, size);
+            sensor->set_quality(sensor, quality);
+            for (int i = 0; i < BENCH_WARMUP_FRAMES; i++)
+            {
+                camera_fb_t *fb = esp_camera_fb_get();
+                if (fb)
+                {
+                    esp_camera_fb_return(fb);
+                }
+            }
+
+            BenchResult &result = benchResults[benchResultCount++];
+            result = {size, quality, 0, -1, 0, -1, 0};
+
+            // Rate is measured between the first and last frame, so the first wait is excluded
+            camera_fb_t *last = NULL;
+            uint64_t totalBytes = 0;
+            int64_t firstUs = 0;
+            int64_t lastUs = 0;
+            for (int i = 0; i < benchFrames; i++)
+            {
+                camera_fb_t *fb = esp_camera_fb_get();
+                if (!fb)
+                {
+                    continue;
+                }
+                lastUs = esp_timer_get_time();
+                if (result.frames++ == 0)
+                {
+                    firstUs = lastUs;
+                }
+                totalBytes += fb->len;
+                if (last)
+                {
+                    esp_camera_fb_return(last);
+                }
+                last = fb;
+
+                // A single buffer has to go back before the driver can fill it again
+                if (cameraFbCount == 1 && i < benchFrames - 1)
+                {
+                    esp_camera_fb_return(last);
+                    last = NULL;
+                }
+            }
+
+            if (result.frames > 1 && lastUs > firstUs)
+            {
+                result.fps = (result.frames - 1) * 1000000.0f / (lastUs - firstUs);
+            }
+            if (!last && result.frames > 0)
+            {
+                last = esp_camera_fb_get(); // the final grab failed; encode a fresh one
+            }
+            if (last)
+            {
+                result.avgBytes = totalBytes / result.frames;
+                result.encodeUs = benchEncode(last, rgbBuf);
+                if (loopFd >= 0)
+                {
+                    result.loopbackKBps = benchLoopbackSend(loopFd, last->buf, last->len);
+                }
+                esp_camera_fb_return(last);
+            }
+            vTaskDelay(1);
+        }
+    }
+
+    if (loopFd >= 0)
+    {
+        close(loopFd);
+    }
+    if (listenFd >= 0)
+    {
+        close(listenFd);
+    }
+    free(rgbBuf);
+}
+
+void benchSendResults(httpd_req_t *req, bool ready)
+{
+    char json[256];
+
+    setCORSHeaders(req);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    if (!ready)
+    {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "{\"error\":\"camera unavailable\"}");
+        return;
+    }
+
+    int len = snprintf(json, sizeof(json),
+                       "{\"fb_count\":%d,\"max_frame_size\":\"%s\",\"xclk_mhz\":%d,\"cpu_mhz\":%u,\"psram\":%s,"
+                       "\"frames_per_point\":%d,\"loopback_bytes\":%u,\"frame2jpg_quality\":80,\"results\":[",
+                       cameraFbCount, frameSizeName(cameraMaxFrameSize), cameraSettings.xclkMhz, getCpuFrequencyMhz(),
+                       psramFound() ? "true" : "false", benchFrames, (unsigned)BENCH_LOOPBACK_BYTES);
+    httpd_resp_send_chunk(req, json, len);
+
+    for (int i = 0; i < benchResultCount; i++)
+    {
+        const BenchResult &r = benchResults[i];
+        char fps[16] = "null";
+        char encode[16] = "null";
+        char loopback[16] = "null";
+        if (r.fps >= 0)
+        {
+            snprintf(fps, sizeof(fps), "%.2f", r.fps);
+        }
+        if (r.encodeUs >= 0)
+        {
+            snprintf(encode, sizeof(encode), "%.2f", r.encodeUs / 1000.0f);
+        }
+        if (r.loopbackKBps)
+        {
+            snprintf(loopback, sizeof(loopback), "%u", r.loopbackKBps);
+        }
+        len = snprintf(json, sizeof(json),
+                       "%s{\"frame_size\":\"%s\",\"quality\":%d,\"frames\":%d,\"fps\":%s,\"avg_bytes\":%u,"
+                       "\"frame2jpg_ms\":%s,\"loopback_kbps\":%s}",
+                       i ? "," : "", frameSizeName(r.size), r.quality, r.frames, fps, r.avgBytes, encode, loopback);
+        httpd_resp_send_chunk(req, json, len);
+    }
+
+    httpd_resp_sendstr_chunk(req, "]}");
+    httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// Runs the sweep off the control httpd, so /control keeps answering meanwhile
+static void bench_task(void *arg)
+{
+    httpd_req_t *req = (httpd_req_t *)arg;
+    int64_t start = esp_timer_get_time();
+
+    benchRequested = true;
+    xTaskNotifyGive(captureTaskHandle);
+    xSemaphoreTake(benchParked, portMAX_DELAY);
+
+    bool ready = benchCameraReady;
+    if (ready)
+    {
+        benchSweep();
+    }
+
+    benchRequested = false;
+    xSemaphoreGive(benchResume);
+    Serial.printf("Benchmark: %d points in %lld ms\n", benchResultCount, (esp_timer_get_time() - start) / 1000);
+
+    benchSendResults(req, ready);
+    httpd_req_async_handler_complete(req);
+    noteActivity();
+    benchActive = false;
+    vTaskDelete(NULL);
+}
+
+// **Capture task: grabs each frame once for all subscribers**
+static void capture_task(void *arg)
+{
+    while (true)
+    {
+        // A running /bench owns the sensor until it hands it back
+        if (benchRequested)
+        {
+            benchPark();
+            continue;
+        }
+
+        // Settings change between frames, never during a grab
+        if (settingsPending && !cameraAsleep)
+        {
+            cameraApplyPendingSettings();
+        }
+
+        if (frameSubscriberCount == 0)
+        {
+            if (!cameraAsleep && cameraIdle())
+            {
+                cameraSleep();
+            }
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(IDLE_CHECK_INTERVAL_MS));
+            continue;
+        }
+
+        // Background consumers alone do not wake the camera
+        if (cameraAsleep && (cameraIdle() || !cameraWake()))
+        {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(IDLE_CHECK_INTERVAL_MS));
+            continue;
+        }
+
+        unsigned long frameStart = millis();
+
+        // Wait for a free slot so we never hold more buffers than the driver has
+        xSemaphoreTake(frameSlots, portMAX_DELAY);
+
+        SharedFrame *frame = NULL;
+        for (int i = 0; i < FRAME_POOL_SIZE; i++)
+        {
+            if (framePool[i].fb == NULL)
+            {
+                frame = &framePool[i];
+                break;
+            }
+        }
+
+        int64_t grabStart = esp_timer_get_time();
+        camera_fb_t *fb = esp_camera_fb_get();
+        latencyRecord(LAT_FB_GET, esp_timer_get_time() - grabStart);
+        if (!fb)
+        {
+            Serial.println("Camera capture failed");
+            captureFailures++;
+            xSemaphoreGive(frameSlots);
+            delay(100);
+            continue;
+        }
+
+        int64_t timestamp_us = (int64_t)fb->timestamp.tv_sec * 1000000LL + fb->timestamp.tv_usec;
+
+        // A single buffer keeps whatever was captured when it was last returned
+        if (cameraFbCount == 1 && esp_timer_get_time() - timestamp_us > FRAME_STALE_US)
+        {
+            esp_camera_fb_return(fb);
+            fb = esp_camera_fb_get();
+            if (!fb)
+            {
+                captureFailures++;
+                xSemaphoreGive(frameSlots);
+                continue;
+            }
+            timestamp_us = (int64_t)fb->timestamp.tv_sec * 1000000LL + fb->timestamp.tv_usec;
+        }
+
+        frame->fb = fb;
+        frame->timestamp_us = timestamp_us;
+        frame->seq = ++frameSequence;
+        if (fb->format != PIXFORMAT_JPEG)
+        {
+            int64_t encodeStart = esp_timer_get_time();
+            bool converted = frame2jpg(fb, 80, &frame->buf, &frame->len);
+            latencyRecord(LAT_JPEG_ENCODE, esp_timer_get_time() - encodeStart);
+            if (!converted)
+            {
+                Serial.println("JPEG compression failed");
+                captureFailures++;
+                esp_camera_fb_return(fb);
+                frame->fb = NULL;
+                xSemaphoreGive(frameSlots);
+                continue;
+            }
+        }
+        else
+        {
+            frame->buf = fb->buf;
+            frame->len = fb->len;
+        }
+
+        framesCaptured++;
+        lastFrameUs = timestamp_us;
+
+        // Post the frame to every mailbox, then drop our own reference
+        TaskHandle_t wake[MAX_FRAME_SUBSCRIBERS];
+        SharedFrame *stale[MAX_FRAME_SUBSCRIBERS];
+        int wakeCount = 0;
+        int staleCount = 0;
+        SharedFrame *previous = NULL;
+
+        frame->refs = 1;
+        portENTER_CRITICAL(&frameMux);
+        if (cameraFbCount > 1)
+        {
+            previous = latestFrame;
+            latestFrame = frame;
+            frame->refs++;
+        }
+        for (int i = 0; i < MAX_FRAME_SUBSCRIBERS; i++)
+        {
+            FrameSubscriber *sub = frameSubscribers[i];
+            if (!sub)
+            {
+                continue;
+            }
+            if (sub->pending)
+            {
+                // Latest frame wins: the unsent one is stale now
+                stale[staleCount++] = sub->pending;
+                sub->dropped++;
+            }
+            sub->pending = frame;
+            frame->refs++;
+            wake[wakeCount++] = sub->task;
+        }
+        portEXIT_CRITICAL(&frameMux);
+
+        for (int i = 0; i < wakeCount; i++)
+        {
+            xTaskNotifyGive(wake[i]);
+        }
+        for (int i = 0; i < staleCount; i++)
+        {
+            frameRelease(stale[i]);
+        }
+        if (previous)
+        {
+            frameRelease(previous);
+        }
+        frameRelease(frame);
+
+        adaptiveUpdate();
+
+        // **PERFORMANCE FIX: Frame rate limiting**
+        unsigned long frameTime = millis() - frameStart;
+        if (frameTime < adaptive.frameDelayMs)
+        {
+            delay(adaptive.frameDelayMs - frameTime);
+        }
+    }
+}
+
+// **Pre-roll clip buffer**
+// The upload task copies a frame into a fixed byte arena every
+// CLIP_FRAME_INTERVAL_MS, so driver buffers are never held for the clip and
+// nothing is allocated per frame. Frames are written back to back and wrap to
+// the start of the arena, evicting the oldest ones they overlap.
+struct ClipEntry
+{
+    size_t offset;
+    size_t len;
+    uint32_t seq;
+    int64_t timestamp_us;
+    uint16_t width;
+    uint16_t height;
+};
+
+struct ClipRing
+{
+    uint8_t *arena;
+    size_t size;
+    size_t head;          // next write offset
+    uint32_t keepFromSeq; // while an event is recorded, never evict frames from this seq on
+    ClipEntry entries[CLIP_MAX_FRAMES];
+    int first; // oldest entry
+    int count;
+};
+
+ClipRing clip = {NULL, 0, 0, 0, {}, 0, 0};
+uint32_t clipEvents = 0;
+uint32_t lastClipSeq = 0;
+portMUX_TYPE clipMux = portMUX_INITIALIZER_UNLOCKED; // entries and the pin; the sender reads pinned frames
+
+bool clipInit()
+{
+    bool psram = psramFound();
+    clip.size = psram ? CLIP_ARENA_BYTES_PSRAM : CLIP_ARENA_BYTES_DRAM;
+    clip.arena = (uint8_t *)(psram ? ps_malloc(clip.size) : malloc(clip.size));
+    if (!clip.arena)
+    {
+        clip.size = 0;
+        Serial.println("Clip buffer: out of memory, uploading single frames");
+        return false;
+    }
+    Serial.printf("Clip buffer: %u bytes in %s\n", clip.size, psram ? "PSRAM" : "DRAM");
+    return true;
+}
+
+// Returns false when the frame does not fit without evicting the event being recorded
+bool clipEvict()
+{
+    ClipEntry &oldest = clip.entries[clip.first];
+    if (clip.keepFromSeq && oldest.seq >= clip.keepFromSeq)
+    {
+        return false;
+    }
+    clip.first = (clip.first + 1) % CLIP_MAX_FRAMES;
+    clip.count--;
+    return true;
+}
+
+// Free room for len bytes; returns the write offset, or -1 if the pin is in the way
+int clipReserve(size_t len)
+{
+    if (clip.count == 0)
+    {
+        clip.head = 0;
+    }
+
+    size_t offset = clip.head;
+    if (offset + len > clip.size)
+    {
+        // Wrapping: everything past the head is older than what sits at the start
+        while (clip.count > 0 && clip.entries[clip.first].offset >= clip.head)
+        {
+            if (!clipEvict())
+            {
+                return -1;
+            }
+        }
+        offset = 0;
+    }
+    while (clip.count > 0)
+    {
+        ClipEntry &oldest = clip.entries[clip.first];
+        bool overlaps = oldest.offset < offset + len && offset < oldest.offset + oldest.len;
+        if (!overlaps && clip.count < CLIP_MAX_FRAMES)
+        {
+            break;
+        }
+        if (!clipEvict())
+        {
+            return -1;
+        }
+    }
+    return offset;
+}
+
+bool clipStore(const SharedFrame *frame)
+{
+    size_t len = frame->len;
+    if (len > clip.size)
+    {
+        return false;
+    }
+
+    portENTER_CRITICAL(&clipMux);
+    int offset = clipReserve(len);
+    portEXIT_CRITICAL(&clipMux);
+    if (offset < 0)
+    {
+        return false;
+    }
+
+    // The reserved range is outside the pin, so the sender never reads it
+    memcpy(clip.arena + offset, frame->buf, len);
+
+    portENTER_CRITICAL(&clipMux);
+    ClipEntry &entry = clip.entries[(clip.first + clip.count) % CLIP_MAX_FRAMES];
+    entry = {(size_t)offset, len, frame->seq, frame->timestamp_us, (uint16_t)frame->fb->width,
+             (uint16_t)frame->fb->height};
+    clip.count++;
+    clip.head = offset + len;
+    portEXIT_CRITICAL(&clipMux);
+
+    lastClipSeq = frame->seq;
+    return true;
+}
+
+void clipUnpin()
+{
+    portENTER_CRITICAL(&clipMux);
+    clip.keepFromSeq = 0;
+    portEXIT_CRITICAL(&clipMux);
+}
+
+// Grab the newest frame into the clip unless it is already there
+bool clipRecord()
+{
+    SharedFrame *frame = frameGetFresh(CLIP_FRAME_INTERVAL_MS);
+    if (!frame)
+    {
+        return false;
+    }
+    bool stored = frame->seq == lastClipSeq || clipStore(frame);
+    frameRelease(frame);
+    return stored;
+}
+
+// **Batched multipart upload body**
+// Streams a multipart/form-data body to HTTPClient straight from the frame
+// buffers: part headers are formatted as they are reached and the JPEG bytes
+// are read in place, so the whole batch never has to sit in one buffer.
+#define UPLOAD_BOUNDARY "esp32camframe"
+
+struct UploadPart
+{
+    const uint8_t *buf;
+    size_t len;
+    uint32_t seq;
+    int64_t timestamp_us;
+    int width;
+    int height;
+};
+
+class MultipartBodyStream : public Stream
+{
+public:
+    MultipartBodyStream(const UploadPart *parts, int count) : parts(parts), count(count) { rewind(); }
+
+    size_t contentLength()
+    {
+        size_t total = strlen(closing());
+        for (int i = 0; i < count; i++)
+        {
+            total += formatHeader(i) + parts[i].len + 2;
+        }
+        rewind();
+        return total;
+    }
+
+    int available() override
+    {
+        while (part <= count)
+        {
+            size_t left = segmentLen() - offset;
+            if (left > 0)
+            {
+                return left;
+            }
+            advance();
+        }
+        return 0;
+    }
+
+    size_t readBytes(char *buffer, size_t length) override
+    {
+        size_t done = 0;
+        while (done < length && available() > 0)
+        {
+            size_t n = min(length - done, segmentLen() - offset);
+            memcpy(buffer + done, segmentData() + offset, n);
+            offset += n;
+            done += n;
+        }
+        return done;
+    }
+
+    int read() override
+    {
+        char c;
+        return readBytes(&c, 1) == 1 ? (uint8_t)c : -1;
+    }
+
+    int peek() override
+    {
+        return available() > 0 ? (uint8_t)segmentData()[offset] : -1;
+    }
+
+    size_t write(uint8_t) override { return 0; }
+
+private:
+    enum Segment
+    {
+        SEG_HEADER,
+        SEG_BODY,
+        SEG_CRLF
+    };
+
+    const UploadPart *parts;
+    int count;
+    int part; // index of the current part, count means the closing boundary
+    Segment segment;
+    size_t offset;
+    char header[192];
+    size_t headerLen;
+
+    static const char *closing() { return "--" UPLOAD_BOUNDARY "--\r\n"; }
+
+    size_t formatHeader(int i)
+    {
+        headerLen = snprintf(header, sizeof(header),
+                             "--" UPLOAD_BOUNDARY "\r\nContent-Disposition: form-data; name=\"frame\"; filename=\"%u.jpg\"\r\n"
+                             "Content-Type: image/jpeg\r\nX-Frame-Seq: %u\r\nX-Frame-Timestamp: %lld\r\n\r\n",
+                             parts[i].seq, parts[i].seq, parts[i].timestamp_us);
+        return headerLen;
+    }
+
+    void rewind()
+    {
+        part = 0;
+        segment = SEG_HEADER;
+        offset = 0;
+        if (count > 0)
+        {
+            formatHeader(0);
+        }
+    }
+
+    void advance()
+    {
+        offset = 0;
+        if (part == count)
+        {
+            part++;
+        }
+        else if (segment == SEG_HEADER)
+        {
+            segment = SEG_BODY;
+        }
+        else if (segment == SEG_BODY)
+        {
+            segment = SEG_CRLF;
+        }
+        else
+        {
+            segment = SEG_HEADER;
+            if (++part < count)
+            {
+                formatHeader(part);
+            }
+        }
+    }
+
+    size_t segmentLen()
+    {
+        if (part == count)
+        {
+            return strlen(closing());
+        }
+        if (part > count)
+        {
+            return 0;
+        }
+        return segment == SEG_HEADER ? headerLen : segment == SEG_BODY ? parts[part].len : 2;
+    }
+
+    const char *segmentData()
+    {
+        if (part == count)
+        {
+            return closing();
+        }
+        return segment == SEG_HEADER ? header : segment == SEG_BODY ? (const char *)parts[part].buf : "\r\n";
+    }
+};
+
+// **Upload task: turns triggers into upload jobs**
+// Records the pre-roll between triggers and queues each event for the
+// sender without waiting, so a slow or absent server never stalls it. A job
+// is either one referenced shared frame or a pinned range of the clip. Only
+// one clip can be pinned at a time; a trigger while it is still queued
+// sends a single still instead.
+struct UploadJob
+{
+    SharedFrame *frame; // single still, or NULL for a clip range
+    uint32_t clipFromSeq;
+    uint32_t clipToSeq;
+    const char *trigger;
+};
+
+bool queueUpload(const UploadJob &job)
+{
+    if (xQueueSend(uploadQueue, &job, 0) == pdTRUE)
+    {
+        return true;
+    }
+
+    uploadsDropped++;
+    Serial.println("Upload queue full, event dropped");
+    if (job.frame)
+    {
+        frameRelease(job.frame);
+    }
+    else
+    {
+        clipUnpin();
+    }
+    return false;
+}
+
+// Pre-roll from before the trigger plus CLIP_POSTROLL_FRAMES after it
+bool queueClip(const char *trigger)
+{
+    int64_t eventUs = esp_timer_get_time();
+    int64_t prerollStart = eventUs - (int64_t)CLIP_PREROLL_MS * 1000;
+    uint32_t fromSeq = frameSequence + 1;
+
+    // Pin the pre-roll so the post-roll frames cannot evict it
+    portENTER_CRITICAL(&clipMux);
+    bool busy = clip.keepFromSeq != 0;
+    if (!busy)
+    {
+        for (int i = 0; i < clip.count; i++)
+        {
+            ClipEntry &entry = clip.entries[(clip.first + i) % CLIP_MAX_FRAMES];
+            if (entry.timestamp_us >= prerollStart)
+            {
+                fromSeq = entry.seq;
+                break;
+            }
+        }
+        clip.keepFromSeq = fromSeq;
+    }
+    portEXIT_CRITICAL(&clipMux);
+
+    if (busy)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < CLIP_POSTROLL_FRAMES; i++)
+    {
+        if (!clipRecord())
+        {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(CLIP_FRAME_INTERVAL_MS));
+    }
+
+    clipEvents++;
+    return queueUpload({NULL, fromSeq, lastClipSeq, trigger});
+}
+
+static void upload_task(void *arg)
+{
+    bool clipEnabled = clipInit();
+
+    while (true)
+    {
+        EventBits_t triggers =
+            xEventGroupWaitBits(uploadTriggers, UPLOAD_TRIGGER_ALL, pdTRUE, pdFALSE,
+                                clipEnabled ? pdMS_TO_TICKS(CLIP_FRAME_INTERVAL_MS) : portMAX_DELAY);
+        if ((triggers & UPLOAD_TRIGGER_ALL) == 0)
+        {
+            if (!cameraAsleep)
+            {
+                clipRecord();
+            }
+            continue;
+        }
+
+        const char *trigger = (triggers & UPLOAD_TRIGGER_BUTTON) ? "button" : "motion";
+        if (clipEnabled && queueClip(trigger))
+        {
+            continue;
+        }
+
+        SharedFrame *frame = frameGetFresh(CAPTURE_DEFAULT_MAX_AGE_MS);
+        if (!frame)
+        {
+            Serial.println("Upload skipped: no frame");
+            continue;
+        }
+        queueUpload({frame, 0, 0, trigger});
+    }
+}
+
+// **Region-of-interest crop**
+// Decodes a frame to RGB565 in a PSRAM scratch buffer, keeps the rows and
+// columns of the ROI and re-encodes only that, so the server gets a smaller
+// JPEG and runs its detector over the doorway instead of the whole scene.
+uint8_t *roiDecodeBuf = NULL;
+size_t roiDecodeSize = 0;
+uint8_t *roiArena = NULL;
+
+bool roiInit()
+{
+    if (!psramFound())
+    {
+        return false;
+    }
+    roiDecodeSize = resolution[cameraMaxFrameSize].width * resolution[cameraMaxFrameSize].height * 2;
+    roiDecodeBuf = (uint8_t *)ps_malloc(roiDecodeSize);
+    roiArena = (uint8_t *)ps_malloc(ROI_ARENA_BYTES);
+    return roiDecodeBuf != NULL && roiArena != NULL;
+}
+
+// Crop rectangle for a frame, false when the whole frame should be sent
+bool roiResolve(const CameraSettings &settings, int frameW, int frameH, RoiRect *rect)
+{
+    if (settings.roiMode == ROI_RECT)
+    {
+        *rect = settings.roi;
+    }
+    else if (settings.roiMode == ROI_MOTION)
+    {
+        MotionBox box;
+        unsigned long boxTime;
+        portENTER_CRITICAL(&motionMux);
+        box = motionBox;
+        boxTime = motionBoxTime;
+        portEXIT_CRITICAL(&motionMux);
+
+        if (box.x1 <= box.x0 || millis() - boxTime > ROI_MOTION_MAX_AGE_MS)
+        {
+            return false; // no recent motion: send the whole frame
+        }
+        rect->x = box.x0 - ROI_MOTION_MARGIN;
+        rect->y = box.y0 - ROI_MOTION_MARGIN;
+        rect->w = box.x1 - box.x0 + 2 * ROI_MOTION_MARGIN;
+        rect->h = box.y1 - box.y0 + 2 * ROI_MOTION_MARGIN;
+    }
+    else
+    {
+        return false;
+    }
+
+    rect->x = constrain(rect->x, 0, frameW);
+    rect->y = constrain(rect->y, 0, frameH);
+    rect->w = min(rect->w, frameW - rect->x);
+    rect->h = min(rect->h, frameH - rect->y);
+    return rect->w >= 16 && rect->h >= 16 && (rect->w < frameW || rect->h < frameH);
+}
+
+// Returns a fmt2jpg() buffer the caller frees, or NULL to send the original
+uint8_t *roiCrop(const UploadPart &part, const RoiRect &rect, size_t *outLen)
+{
+    // Downscale big crops in the decoder, where it is nearly free
+    int shift = 0;
+    while (shift < 2 && max(rect.w, rect.h) >> shift > ROI_MAX_SIDE)
+    {
+        shift++;
+    }
+
+    int decW = part.width >> shift;
+    int decH = part.height >> shift;
+    if ((size_t)(decW * decH * 2) > roiDecodeSize ||
+        !jpg2rgb565(part.buf, part.len, roiDecodeBuf, (jpg_scale_t)shift))
+    {
+        return NULL;
+    }
+
+    // Pack the crop rows to the front of the buffer; each row moves backwards
+    int x = rect.x >> shift;
+    int y = rect.y >> shift;
+    int w = min(rect.w >> shift, decW - x);
+    int h = min(rect.h >> shift, decH - y);
+    for (int row = 0; row < h; row++)
+    {
+        memmove(roiDecodeBuf + row * w * 2, roiDecodeBuf + ((y + row) * decW + x) * 2, w * 2);
+    }
+
+    uint8_t *out = NULL;
+    if (!fmt2jpg(roiDecodeBuf, w * h * 2, w, h, PIXFORMAT_RGB565, ROI_JPEG_QUALITY, &out, outLen))
+    {
+        return NULL;
+    }
+    return out;
+}
+
+// Crops every part of a batch into roiArena, freeing each fmt2jpg() buffer as
+// soon as it is copied so only one is alive at a time. Either all parts that
+// have a crop rectangle get cropped or none do: on any failure the parts are
+// left pointing at the full frames, so the server never gets a mixed batch.
+bool roiCropBatch(UploadPart *parts, int count, const CameraSettings &settings)
+{
+    const uint8_t *cropped[CLIP_MAX_FRAMES];
+    size_t croppedLen[CLIP_MAX_FRAMES];
+    size_t used = 0;
+    RoiRect rect;
+
+    for (int i = 0; i < count; i++)
+    {
+        cropped[i] = NULL;
+        if (!roiResolve(settings, parts[i].width, parts[i].height, &rect))
+        {
+            continue;
+        }
+
+        size_t cropLen = 0;
+        uint8_t *crop = roiCrop(parts[i], rect, &cropLen);
+        if (!crop || used + cropLen > ROI_ARENA_BYTES)
+        {
+            Serial.printf("ROI crop failed on frame %u (%s), sending full frames\n", parts[i].seq,
+                          crop ? "arena full" : "encode");
+            free(crop);
+            roiFallbacks++;
+            return false;
+        }
+        memcpy(roiArena + used, crop, cropLen);
+        free(crop);
+        cropped[i] = roiArena + used;
+        croppedLen[i] = cropLen;
+        used += cropLen;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (cropped[i])
+        {
+            parts[i].buf = cropped[i];
+            parts[i].len = croppedLen[i];
+        }
+    }
+    return true;
+}
+
+// **Upload sender: one persistent connection to serverUrl**
+// HTTPClient keeps the socket open between requests (keep-alive) as long as
+// the server allows it, so consecutive events skip the TCP handshake and slow
+// start. Transport errors back off exponentially before the job is retried.
+int uploadFrames(HTTPClient &http, const UploadPart *parts, int count, const char *trigger)
+{
+    MultipartBodyStream body(parts, count);
+    size_t length = body.contentLength();
+
+    http.begin(serverUrl);
+    http.setTimeout(UPLOAD_TIMEOUT_MS);
+    http.addHeader("Content-Type", "multipart/form-data; boundary=" UPLOAD_BOUNDARY);
+    http.addHeader("X-Trigger", trigger);
+    http.addHeader("X-Device-Time", String(esp_timer_get_time()));
+
+    int code = http.sendRequest("POST", &body, length);
+    http.end(); // keeps the connection when both sides agreed to reuse it
+    return code;
+}
+
+static void upload_sender_task(void *arg)
+{
+    HTTPClient http;
+    http.setReuse(true);
+    unsigned long backoffMs = 0;
+    bool roiSupported = roiInit();
+
+    while (true)
+    {
+        UploadJob job;
+        xQueueReceive(uploadQueue, &job, portMAX_DELAY);
+
+        UploadPart parts[CLIP_MAX_FRAMES];
+        int count = 0;
+        if (job.frame)
+        {
+            parts[count++] = {job.frame->buf, job.frame->len, job.frame->seq, job.frame->timestamp_us,
+                              job.frame->fb->width, job.frame->fb->height};
+        }
+        else
+        {
+            portENTER_CRITICAL(&clipMux);
+            for (int i = 0; i < clip.count; i++)
+            {
+                ClipEntry &entry = clip.entries[(clip.first + i) % CLIP_MAX_FRAMES];
+                if (entry.seq >= job.clipFromSeq && entry.seq <= job.clipToSeq)
+                {
+                    parts[count++] = {clip.arena + entry.offset, entry.len, entry.seq, entry.timestamp_us,
+                                      entry.width, entry.height};
+                }
+            }
+            portEXIT_CRITICAL(&clipMux);
+        }
+
+        // Swap the parts for their ROI crops; the arena is reused by the next job
+        if (roiSupported && count > 0)
+        {
+            CameraSettings settings;
+            portENTER_CRITICAL(&settingsMux);
+            settings = cameraSettings;
+            portEXIT_CRITICAL(&settingsMux);
+            roiCropBatch(parts, count, settings);
+        }
+
+        int code = 0;
+        for (int attempt = 0; count > 0 && attempt < UPLOAD_MAX_ATTEMPTS; attempt++)
+        {
+            if (backoffMs)
+            {
+                vTaskDelay(pdMS_TO_TICKS(backoffMs));
+            }
+            if (WiFi.status() != WL_CONNECTED)
+            {
+                code = 0;
+            }
+            else
+            {
+                code = uploadFrames(http, parts, count, job.trigger);
+            }
+
+            // Any HTTP status means the server is reachable; only transport errors back off
+            if (code > 0)
+            {
+                backoffMs = 0;
+                break;
+            }
+            uploadReconnects++;
+            backoffMs = backoffMs ? min(backoffMs * 2, UPLOAD_BACKOFF_MAX_MS) : UPLOAD_BACKOFF_MIN_MS;
+        }
+
+        if (job.frame)
+        {
+            frameRelease(job.frame);
+        }
+        else
+        {
+            clipUnpin();
+        }
+
+        if (code >= 200 && code < 300)
+        {
+            uploadsSent++;
+        }
+        else
+        {
+            uploadsFailed++;
+        }
+        Serial.printf("Upload finished: %d frames (%s), HTTP %d\n", count, job.trigger, code);
+    }
+}
+
+void requestUpload(uint32_t trigger)
+{
+    noteActivity();
+    if (uploadTriggers)
+    {
+        xEventGroupSetBits(uploadTriggers, trigger);
+    }
+}
+
+// **On-device motion detector**
+// Decodes a frame at 1/8 scale (the JPEG decoder then does little more than
+// the DC terms), reduces it to 8-bit luma and compares 8x8 blocks with the
+// previous check using integer SAD. Enough changed blocks trigger an upload,
+// so the server only runs recognition when something moves at the door.
+void rgb565ToLuma(const uint8_t *rgb, uint8_t *luma, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++)
+    {
+        // jpg2rgb565() stores pixels high byte first
+        uint32_t px = ((uint32_t)rgb[2 * i] << 8) | rgb[2 * i + 1];
+        uint32_t r = (px >> 8) & 0xF8;
+        uint32_t g = (px >> 3) & 0xFC;
+        uint32_t b = (px << 3) & 0xF8;
+        luma[i] = (uint8_t)((r * 77 + g * 150 + b * 29) >> 8);
+    }
+}
+
+// Count 8x8 blocks whose summed absolute difference exceeds the threshold.
+// The inner loop is unrolled by four over byte rows so it stays branch-free.
+int motionCompare(const uint8_t *cur, const uint8_t *prev, int w, int h, MotionBox *box)
+{
+    const uint32_t threshold = MOTION_PIXEL_DELTA * MOTION_BLOCK * MOTION_BLOCK;
+    int changed = 0;
+
+    box->x0 = w;
+    box->y0 = h;
+    box->x1 = 0;
+    box->y1 = 0;
+
+    for (int by = 0; by + MOTION_BLOCK <= h; by += MOTION_BLOCK)
+    {
+        for (int bx = 0; bx + MOTION_BLOCK <= w; bx += MOTION_BLOCK)
+        {
+            uint32_t sad = 0;
+            for (int y = by; y < by + MOTION_BLOCK; y++)
+            {
+                const uint8_t *a = cur + y * w + bx;
+                const uint8_t *b = prev + y * w + bx;
+                for (int x = 0; x < MOTION_BLOCK; x += 4)
+                {
+                    sad += abs(a[x] - b[x]) + abs(a[x + 1] - b[x + 1]) +
+                           abs(a[x + 2] - b[x + 2]) + abs(a[x + 3] - b[x + 3]);
+                }
+            }
+
+            if (sad > threshold)
+            {
+                changed++;
+                box->x0 = min(box->x0, bx);
+                box->y0 = min(box->y0, by);
+                box->x1 = max(box->x1, bx + MOTION_BLOCK);
+                box->y1 = max(box->y1, by + MOTION_BLOCK);
+            }
+        }
+    }
+    return changed;
+}
+
+static void motion_task(void *arg)
+{
+    size_t maxPixels = (resolution[cameraMaxFrameSize].width / 8) * (resolution[cameraMaxFrameSize].height / 8);
+    uint8_t *rgb = (uint8_t *)malloc(maxPixels * 2);
+    uint8_t *luma = (uint8_t *)malloc(maxPixels);
+    uint8_t *previous = (uint8_t *)malloc(maxPixels);
+    int prevW = 0;
+    int prevH = 0;
+    unsigned long lastTrigger = 0;
+
+    if (!rgb || !luma || !previous)
+    {
+        Serial.println("Motion detector: out of memory");
+        free(rgb);
+        free(luma);
+        free(previous);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    while (true)
+    {
+        vTaskDelay(pdMS_TO_TICKS(MOTION_INTERVAL_MS));
+
+        if (!motionEnabled || cameraAsleep)
+        {
+            prevW = 0;
+            continue;
+        }
+
+        SharedFrame *frame = frameGetFresh(MOTION_INTERVAL_MS);
+        if (!frame)
+        {
+            continue;
+        }
+
+        int w = frame->fb->width / 8;
+        int h = frame->fb->height / 8;
+        bool decoded = (size_t)(w * h) <= maxPixels &&
+                       jpg2rgb565(frame->buf, frame->len, rgb, JPG_SCALE_8X);
+        frameRelease(frame);
+
+        if (!decoded)
+        {
+            continue;
+        }
+        rgb565ToLuma(rgb, luma, w * h);
+
+        if (w == prevW && h == prevH)
+        {
+            MotionBox box;
+            int changed = motionCompare(luma, previous, w, h, &box);
+            motionChangedBlocks = changed;
+
+            unsigned long now = millis();
+            if (changed >= MOTION_MIN_BLOCKS)
+            {
+                lastMotionTime = now;
+                portENTER_CRITICAL(&motionMux);
+                motionBox = {box.x0 * 8, box.y0 * 8, box.x1 * 8, box.y1 * 8};
+                motionBoxTime = now;
+                portEXIT_CRITICAL(&motionMux);
+
+                if (lastTrigger == 0 || now - lastTrigger >= MOTION_COOLDOWN_MS)
+                {
+                    lastTrigger = now;
+                    motionEvents++;
+                    Serial.printf("Motion detected: %d blocks\n", changed);
+                    requestUpload(UPLOAD_TRIGGER_MOTION);
+                }
+            }
+        }
+
+        uint8_t *swap = previous;
+        previous = luma;
+        luma = swap;
+        prevW = w;
+        prevH = h;
+    }
+}
+
+// **Per-client stream task, fed by the capture task**
+static void stream_client_task(void *arg)
+{
+    StreamClient *client = (StreamClient *)arg;
+    httpd_req_t *req = client->req;
+    esp_err_t res = ESP_OK;
+    char part_buf[192];
+
+    setCORSHeaders(req);
+    res = httpd_resp_set_type(req, "multipart/x-mixed-replace; boundary=frame");
+
+    if (res == ESP_OK && !frameSubscribe(&client->sub))
+    {
+        res = ESP_FAIL;
+    }
+
+    while (res == ESP_OK)
+    {
+        SharedFrame *frame = frameTake(&client->sub, pdMS_TO_TICKS(STREAM_FRAME_TIMEOUT_MS));
+        if (!frame)
+        {
+            Serial.println("Stream frame timeout");
+            break;
+        }
+
+        // Send frame header; timestamps are esp_timer microseconds since boot
+        size_t hlen = snprintf(part_buf, sizeof(part_buf),
+                               "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n"
+                               "X-Frame-Seq: %u\r\nX-Frame-Timestamp: %lld\r\nX-Device-Time: %lld\r\n\r\n",
+                               frame->len, frame->seq, frame->timestamp_us, esp_timer_get_time());
+
+        int64_t sendStart = esp_timer_get_time();
+        res = httpd_resp_send_chunk(req, part_buf, hlen);
+        int64_t headerDone = esp_timer_get_time();
+        latencyRecord(LAT_STREAM_HEADER, headerDone - sendStart);
+
+        if (res == ESP_OK)
+        {
+            res = httpd_resp_send_chunk(req, (const char *)frame->buf, frame->len);
+            latencyRecord(LAT_STREAM_BODY, esp_timer_get_time() - headerDone);
+        }
+        if (res == ESP_OK)
+        {
+            res = httpd_resp_send_chunk(req, "\r\n", 2);
+        }
+        int64_t sendUs = esp_timer_get_time() - sendStart;
+        latencyRecord(LAT_STREAM_FRAME, sendUs);
+        if (res == ESP_OK)
+        {
+            adaptiveReportSend(sendUs, frame->len);
+        }
+
+        frameRelease(frame);
+    }
+
+    // Cleanup on exit; the idle timer starts once the last viewer leaves
+    frameUnsubscribe(&client->sub);
+    httpd_req_async_handler_complete(req);
+    noteActivity();
+
+    portENTER_CRITICAL(&frameMux);
+    client->req = NULL;
+    portEXIT_CRITICAL(&frameMux);
+
+    vTaskDelete(NULL);
+}
+
+// **WebSocket frame push (/ws)**
+// Each frame goes out as one binary message: a 16-byte little-endian header
+// (seq u32, JPEG size u32, capture time us u64) followed by the JPEG, sent
+// as two fragments so the frame buffer is never copied. Clients ACK with the
+// seq they finished (4-byte binary or decimal text); a client with
+// WS_MAX_INFLIGHT unacknowledged frames is skipped instead of queueing.
+// ws_push_task sends to the clients one after another, so each socket gets a
+// short send timeout: a stalled client is closed after WS_SEND_TIMEOUT_MS
+// instead of holding the next frame back from everyone else.
+struct WsClient
+{
+    int fd; // -1 when free
+    uint32_t lastSentSeq;
+    uint32_t lastAckSeq;
+    unsigned long lastSendTime;
+    uint32_t skipped;
+};
+
+WsClient wsClients[MAX_WS_CLIENTS]; // slots are written under frameMux; startCameraServer() frees them
+volatile int wsClientCount = 0;
+volatile uint32_t wsFramesSkipped = 0;
+TaskHandle_t wsTaskHandle = NULL;
+
+// Frees the slot if it still belongs to fd; a new client may have taken it meanwhile
+void wsRemoveClient(WsClient *client, int fd)
+{
+    portENTER_CRITICAL(&frameMux);
+    if (client->fd >= 0 && client->fd == fd)
+    {
+        client->fd = -1;
+        wsClientCount--;
+    }
+    portEXIT_CRITICAL(&frameMux);
+    noteActivity();
+}
+
+// A send that timed out may have left half a message on the wire, so the
+// socket cannot carry another frame; close it and let the client reconnect
+void wsDropClient(WsClient *client, int fd)
+{
+    wsRemoveClient(client, fd);
+    httpd_sess_trigger_close(stream_httpd, fd);
+}
+
+// Caller holds frameMux
+WsClient *wsFindClient(int fd)
+{
+    for (int i = 0; i < MAX_WS_CLIENTS; i++)
+    {
+        if (wsClients[i].fd == fd)
+        {
+            return &wsClients[i];
+        }
+    }
+    return NULL;
+}
+
+bool wsSendFrame(int fd, SharedFrame *frame)
+{
+    uint8_t header[16];
+    uint32_t len = frame->len;
+    uint64_t ts = (uint64_t)frame->timestamp_us;
+
+    memcpy(header, &frame->seq, 4);
+    memcpy(header + 4, &len, 4);
+    memcpy(header + 8, &ts, 8);
+
+    httpd_ws_frame_t head = {};
+    head.final = false;
+    head.fragmented = true;
+    head.type = HTTPD_WS_TYPE_BINARY;
+    head.payload = header;
+    head.len = sizeof(header);
+
+    httpd_ws_frame_t body = {};
+    body.final = true;
+    body.fragmented = true;
+    body.type = HTTPD_WS_TYPE_CONTINUE;
+    body.payload = frame->buf;
+    body.len = frame->len;
+
+    return httpd_ws_send_frame_async(stream_httpd, fd, &head) == ESP_OK &&
+           httpd_ws_send_frame_async(stream_httpd, fd, &body) == ESP_OK;
+}
+
+static void ws_push_task(void *arg)
+{
+    FrameSubscriber sub;
+    bool subscribed = false;
+
+    while (true)
+    {
+        if (wsClientCount == 0)
+        {
+            if (subscribed)
+            {
+                frameUnsubscribe(&sub);
+                subscribed = false;
+            }
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (!subscribed)
+        {
+            subscribed = frameSubscribe(&sub);
+            if (!subscribed)
+            {
+                delay(100);
+                continue;
+            }
+        }
+
+        SharedFrame *frame = frameTake(&sub, pdMS_TO_TICKS(STREAM_FRAME_TIMEOUT_MS));
+        if (!frame)
+        {
+            continue;
+        }
+
+        unsigned long now = millis();
+        for (int i = 0; i < MAX_WS_CLIENTS; i++)
+        {
+            // ws_handler writes the slot and its ACKs from the httpd task
+            WsClient *client = &wsClients[i];
+            portENTER_CRITICAL(&frameMux);
+            WsClient snapshot = *client;
+            portEXIT_CRITICAL(&frameMux);
+
+            int fd = snapshot.fd;
+            if (fd < 0)
+            {
+                continue;
+            }
+            if (httpd_ws_get_fd_info(stream_httpd, fd) != HTTPD_WS_CLIENT_WEBSOCKET)
+            {
+                wsRemoveClient(client, fd);
+                continue;
+            }
+
+            // Latest frame wins: skip clients still working through earlier frames
+            if (snapshot.lastSentSeq - snapshot.lastAckSeq >= WS_MAX_INFLIGHT &&
+                now - snapshot.lastSendTime < WS_ACK_TIMEOUT_MS)
+            {
+                portENTER_CRITICAL(&frameMux);
+                if (client->fd == fd)
+                {
+                    client->skipped++;
+                }
+                portEXIT_CRITICAL(&frameMux);
+                wsFramesSkipped++;
+                continue;
+            }
+
+            int64_t sendStart = esp_timer_get_time();
+            if (!wsSendFrame(fd, frame))
+            {
+                wsDropClient(client, fd);
+                continue;
+            }
+            latencyRecord(LAT_WS_FRAME, esp_timer_get_time() - sendStart);
+            portENTER_CRITICAL(&frameMux);
+            if (client->fd == fd)
+            {
+                client->lastSentSeq = frame->seq;
+                client->lastSendTime = now;
+            }
+            portEXIT_CRITICAL(&frameMux);
+        }
 
-    res = httpd_resp_set_type(req, "multipart/x-mixed-replace; boundary=frame");
-    if (res != ESP_OK)
-    {
-        return res;
+        frameRelease(frame);
     }
+}
 
-    while (true)
-    {
-        unsigned long frameStart = millis();
-
-        fb = esp_camera_fb_get();
-        if (!fb)
-        {
-            Serial.println("Camera capture failed");
-            res = ESP_FAIL;
-            break; // Exit on persistent failures
-        }
+static esp_err_t ws_handler(httpd_req_t *req)
+{
+    int fd = httpd_req_to_sockfd(req);
+    noteActivity();
 
-        _jpg_buf = NULL;
-        _jpg_buf_len = 0;
+    // Handshake: register the socket for frame pushes
+    if (req->method == HTTP_GET)
+    {
+        bool added = false;
 
-        if (fb->format != PIXFORMAT_JPEG)
+        portENTER_CRITICAL(&frameMux);
+        for (int i = 0; i < MAX_WS_CLIENTS; i++)
         {
-            bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-            if (!jpeg_converted)
+            if (wsClients[i].fd < 0)
             {
-                Serial.println("JPEG compression failed");
-                esp_camera_fb_return(fb);
-                res = ESP_FAIL;
+                wsClients[i] = {fd, frameSequence, frameSequence, 0, 0};
+                wsClientCount++;
+                added = true;
                 break;
             }
         }
-        else
-        {
-            _jpg_buf_len = fb->len;
-            _jpg_buf = fb->buf;
-        }
-
-        // Send frame header
-        size_t hlen = snprintf(part_buf, sizeof(part_buf),
-                               "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n",
-                               _jpg_buf_len);
+        portEXIT_CRITICAL(&frameMux);
 
-        if ((res = httpd_resp_send_chunk(req, part_buf, hlen)) != ESP_OK ||
-            (res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len)) != ESP_OK ||
-            (res = httpd_resp_send_chunk(req, "\r\n", 2)) != ESP_OK)
+        if (!added)
         {
-            break;
+            Serial.println("Too many WebSocket clients");
+            return ESP_FAIL;
         }
 
-        // Cleanup
-        if (fb->format != PIXFORMAT_JPEG && _jpg_buf)
+        // The handshake reply is already out; frame pushes use the short timeout
+        struct timeval timeout = {.tv_sec = 0, .tv_usec = WS_SEND_TIMEOUT_MS * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (wsTaskHandle)
         {
-            free(_jpg_buf);
+            xTaskNotifyGive(wsTaskHandle);
         }
-        esp_camera_fb_return(fb);
-        fb = NULL;
+        return ESP_OK;
+    }
 
-        // **PERFORMANCE FIX: Frame rate limiting**
-        unsigned long frameTime = millis() - frameStart;
-        if (frameTime < STREAM_DELAY_MS)
+    // Data frame: an ACK carrying the last sequence number the client finished.
+    // A payload left unread would be parsed as the next frame header, so
+    // anything that is not a short ACK closes the session instead.
+    uint8_t payload[16];
+    httpd_ws_frame_t pkt = {};
+    if (httpd_ws_recv_frame(req, &pkt, 0) != ESP_OK || pkt.len >= sizeof(payload))
+    {
+        Serial.println("Bad WebSocket message, closing client");
+        return ESP_FAIL;
+    }
+    pkt.payload = payload;
+    if (httpd_ws_recv_frame(req, &pkt, pkt.len) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    uint32_t ack = 0;
+    if (pkt.type == HTTPD_WS_TYPE_BINARY && pkt.len == 4)
+    {
+        memcpy(&ack, payload, 4);
+    }
+    else if (pkt.type == HTTPD_WS_TYPE_TEXT)
+    {
+        payload[pkt.len] = '\0';
+        ack = strtoul((const char *)payload, NULL, 10);
+    }
+    else
+    {
+        return ESP_OK;
+    }
+
+    portENTER_CRITICAL(&frameMux);
+    WsClient *client = wsFindClient(fd);
+    if (client)
+    {
+        client->lastAckSeq = ack;
+    }
+    portEXIT_CRITICAL(&frameMux);
+    return ESP_OK;
+}
+
+// **Stream handler: hands the connection to its own client task**
+static esp_err_t stream_handler(httpd_req_t *req)
+{
+    StreamClient *client = NULL;
+    noteActivity();
+
+    portENTER_CRITICAL(&frameMux);
+    for (int i = 0; i < MAX_STREAM_CLIENTS; i++)
+    {
+        if (streamClients[i].req == NULL)
         {
-            delay(STREAM_DELAY_MS - frameTime);
+            client = &streamClients[i];
+            client->req = req; // reserve the slot
+            break;
         }
     }
+    portEXIT_CRITICAL(&frameMux);
 
-    // Cleanup on exit
-    if (fb)
+    if (!client)
     {
-        esp_camera_fb_return(fb);
+        setCORSHeaders(req);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, "Too many stream clients", -1);
     }
-    if (_jpg_buf && fb && fb->format != PIXFORMAT_JPEG)
+
+    httpd_req_t *async_req = NULL;
+    if (httpd_req_async_handler_begin(req, &async_req) != ESP_OK)
     {
-        free(_jpg_buf);
+        client->req = NULL;
+        return ESP_FAIL;
     }
+    client->req = async_req;
 
-    return res;
+    if (xTaskCreatePinnedToCore(stream_client_task, "stream_client", 4096, client, STREAM_HTTPD_PRIORITY, NULL,
+                                CAMERA_CORE) != pdPASS)
+    {
+        Serial.println("Stream client task creation failed");
+        httpd_req_async_handler_complete(async_req);
+        client->req = NULL;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
 }
 
 // **control handler**
@@ -150,6 +2532,7 @@ static esp_err_t control_handler(httpd_req_t *req)
     char query[100];
 
     setCORSHeaders(req);
+    noteActivity();
 
     if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
     {
@@ -157,14 +2540,8 @@ static esp_err_t control_handler(httpd_req_t *req)
         {
             Serial.println("Door open command received");
 
-            // **Set relay state immediately, let loop() handle timing**
-            digitalWrite(BUZZER_PIN, HIGH);
-            digitalWrite(RELAY_PIN, HIGH);
-            delay(1000);
-            digitalWrite(FLASH_LED_PIN, HIGH);
-
-            relayStartTime = millis();
-            relayActive = true;
+            // **Post the request, loop() drives the buzzer/relay/flash sequence**
+            doorOpenRequested = true;
 
             // ** Immediate response, no delay**
             return httpd_resp_send(req, "{\"status\":\"success\",\"message\":\"Door opened\"}", -1);
@@ -177,27 +2554,361 @@ static esp_err_t control_handler(httpd_req_t *req)
 // **capture handler**
 static esp_err_t capture_handler(httpd_req_t *req)
 {
+    char query[64];
+    char value[16];
+    unsigned long maxAgeMs = CAPTURE_DEFAULT_MAX_AGE_MS;
+
     setCORSHeaders(req);
+    noteActivity();
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "max_age_ms", value, sizeof(value)) == ESP_OK)
+    {
+        maxAgeMs = strtoul(value, NULL, 10);
+    }
 
-    // Use centralized buffer flushing
-    flushCameraBuffer();
+    // Serve the cached frame when fresh enough, otherwise wait for the next one
+    SharedFrame *frame = frameGetFresh(maxAgeMs);
 
-    camera_fb_t *fb = esp_camera_fb_get();
-    if (!fb)
+    if (!frame)
     {
         Serial.println("Camera capture failed");
         return httpd_resp_send_500(req);
     }
 
+    char seq[12];
+    char timestamp[24];
+    char deviceTime[24];
+    snprintf(seq, sizeof(seq), "%u", frame->seq);
+    snprintf(timestamp, sizeof(timestamp), "%lld", frame->timestamp_us);
+    snprintf(deviceTime, sizeof(deviceTime), "%lld", esp_timer_get_time());
+
     httpd_resp_set_type(req, "image/jpeg");
     httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+    httpd_resp_set_hdr(req, "X-Frame-Seq", seq);
+    httpd_resp_set_hdr(req, "X-Frame-Timestamp", timestamp);
+    httpd_resp_set_hdr(req, "X-Device-Time", deviceTime);
 
-    esp_err_t res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
-    esp_camera_fb_return(fb);
+    int64_t sendStart = esp_timer_get_time();
+    esp_err_t res = httpd_resp_send(req, (const char *)frame->buf, frame->len);
+    latencyRecord(LAT_CAPTURE_SEND, esp_timer_get_time() - sendStart);
+    frameRelease(frame);
 
     return res;
 }
 
+int streamClientCount()
+{
+    int count = 0;
+
+    portENTER_CRITICAL(&frameMux);
+    for (int i = 0; i < MAX_STREAM_CLIENTS; i++)
+    {
+        if (streamClients[i].req)
+        {
+            count++;
+        }
+    }
+    portEXIT_CRITICAL(&frameMux);
+
+    return count;
+}
+
+// **health handler: liveness without touching the camera driver**
+static esp_err_t health_handler(httpd_req_t *req)
+{
+    char json[256];
+    int64_t now = esp_timer_get_time();
+    int64_t frameAgeMs = lastFrameUs ? (now - lastFrameUs) / 1000 : -1;
+
+    setCORSHeaders(req);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    int len = snprintf(json, sizeof(json),
+                       "{\"status\":\"ok\",\"uptime_ms\":%lld,\"free_heap\":%u,\"free_psram\":%u,"
+                       "\"rssi\":%d,\"stream_clients\":%d,\"last_frame_us\":%lld,\"last_frame_age_ms\":%lld,"
+                       "\"camera_asleep\":%s}",
+                       now / 1000, ESP.getFreeHeap(), ESP.getFreePsram(),
+                       WiFi.RSSI(), streamClientCount(), lastFrameUs, frameAgeMs, cameraAsleep ? "true" : "false");
+
+    return httpd_resp_send(req, json, len);
+}
+
+// **metrics handler: pipeline counters**
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+    char json[384];
+    char query[32];
+    char value[8];
+    bool reset = false;
+
+    setCORSHeaders(req);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "reset", value, sizeof(value)) == ESP_OK)
+    {
+        reset = strcmp(value, "1") == 0;
+    }
+
+    int len = snprintf(json, sizeof(json),
+                       "{\"uptime_ms\":%lld,\"fb_count\":%d,\"frames_captured\":%u,\"capture_failures\":%u,"
+                       "\"stream_clients\":%d,\"subscribers\":%d,\"free_heap\":%u,\"min_free_heap\":%u,"
+                       "\"free_psram\":%u,\"rssi\":%d,\"wifi_reconnects\":%u,\"ws_clients\":%d,\"ws_frames_skipped\":%u",
+                       esp_timer_get_time() / 1000, cameraFbCount, framesCaptured, captureFailures,
+                       streamClientCount(), frameSubscriberCount, ESP.getFreeHeap(), ESP.getMinFreeHeap(),
+                       ESP.getFreePsram(), WiFi.RSSI(), wifiReconnects, wsClientCount, wsFramesSkipped);
+    httpd_resp_send_chunk(req, json, len);
+
+    // Per-client delivery counters, then the latency histograms
+    bool first = true;
+    httpd_resp_sendstr_chunk(req, ",\"clients\":[");
+    for (int i = 0; i < MAX_STREAM_CLIENTS; i++)
+    {
+        StreamClient &client = streamClients[i];
+        if (!client.req)
+        {
+            continue;
+        }
+        len = snprintf(json, sizeof(json), "%s{\"type\":\"mjpeg\",\"slot\":%d,\"sent\":%u,\"dropped\":%u}",
+                       first ? "" : ",", i, client.sub.delivered, client.sub.dropped);
+        httpd_resp_send_chunk(req, json, len);
+        first = false;
+    }
+    for (int i = 0; i < MAX_WS_CLIENTS; i++)
+    {
+        WsClient client;
+        portENTER_CRITICAL(&frameMux);
+        client = wsClients[i];
+        portEXIT_CRITICAL(&frameMux);
+        if (client.fd < 0)
+        {
+            continue;
+        }
+        len = snprintf(json, sizeof(json), "%s{\"type\":\"ws\",\"slot\":%d,\"last_seq\":%u,\"acked_seq\":%u,\"dropped\":%u}",
+                       first ? "" : ",", i, client.lastSentSeq, client.lastAckSeq, client.skipped);
+        httpd_resp_send_chunk(req, json, len);
+        first = false;
+    }
+    httpd_resp_sendstr_chunk(req, "],\"latency_us\":{");
+
+    // One chunk per stage keeps the stack buffer small
+    for (int s = 0; s < LAT_STAGE_COUNT; s++)
+    {
+        LatencyHistogram &h = latencyStats[s];
+        len = snprintf(json, sizeof(json), "%s\"%s\":{\"count\":%u,\"sum\":%u,\"max\":%u,\"buckets\":[",
+                       s ? "," : "", LATENCY_STAGE_NAMES[s],
+                       h.count.load(std::memory_order_relaxed), h.sum_us.load(std::memory_order_relaxed),
+                       h.max_us.load(std::memory_order_relaxed));
+        for (int i = 0; i < LATENCY_BUCKETS; i++)
+        {
+            len += snprintf(json + len, sizeof(json) - len, "%s%u", i ? "," : "",
+                            h.buckets[i].load(std::memory_order_relaxed));
+        }
+        len += snprintf(json + len, sizeof(json) - len, "]}");
+        httpd_resp_send_chunk(req, json, len);
+    }
+
+    // Upper bound of each bucket; the last one is open-ended
+    len = snprintf(json, sizeof(json), "},\"bucket_le_us\":[");
+    for (int i = 0; i < LATENCY_BUCKETS - 1; i++)
+    {
+        len += snprintf(json + len, sizeof(json) - len, "%s%u", i ? "," : "", 1u << (i + 7));
+    }
+    len += snprintf(json + len, sizeof(json) - len, "]");
+    httpd_resp_send_chunk(req, json, len);
+
+    len = snprintf(json, sizeof(json),
+                   ",\"adaptive\":{\"enabled\":%s,\"frame_delay_ms\":%lu,\"min_delay_ms\":%lu,"
+                   "\"jpeg_quality\":%d,\"base_quality\":%d,\"send_ewma_us\":%d,\"frame_bytes_ewma\":%d,"
+                   "\"target_send_us\":%u,\"max_kbps\":%u},"
+                   "\"motion\":{\"enabled\":%s,\"changed_blocks\":%d,\"events\":%u,\"last_motion_ms\":%lu}",
+                   adaptive.enabled ? "true" : "false", adaptive.frameDelayMs, adaptive.minDelayMs,
+                   adaptive.quality, adaptive.baseQuality, adaptive.sendEwmaUs, adaptive.bytesEwma,
+                   ADAPT_TARGET_SEND_US, ADAPT_MAX_KBPS,
+                   motionEnabled ? "true" : "false", motionChangedBlocks, motionEvents, lastMotionTime);
+    httpd_resp_send_chunk(req, json, len);
+
+    len = snprintf(json, sizeof(json),
+                   ",\"clip\":{\"arena_bytes\":%u,\"frames\":%d,\"events\":%u},"
+                   "\"upload\":{\"queued\":%u,\"sent\":%u,\"failed\":%u,\"dropped\":%u,\"reconnects\":%u,"
+                   "\"roi_fallbacks\":%u}}",
+                   clip.size, clip.count, clipEvents, uploadQueue ? uxQueueMessagesWaiting(uploadQueue) : 0,
+                   uploadsSent, uploadsFailed, uploadsDropped, uploadReconnects, roiFallbacks);
+    httpd_resp_send_chunk(req, json, len);
+
+    if (reset)
+    {
+        latencyReset();
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// **config handler: read or change sensor settings without reflashing**
+// GET /config returns the settings; any of framesize, quality, xclk,
+// brightness, gain, fps, adaptive, motion or roi (off, motion or x,y,w,h)
+// in the query string changes them.
+static esp_err_t config_handler(httpd_req_t *req)
+{
+    char query[192];
+    char value[24];
+    char json[384];
+    bool changed = false;
+
+    setCORSHeaders(req);
+    httpd_resp_set_type(req, "application/json");
+
+    CameraSettings settings;
+    portENTER_CRITICAL(&settingsMux);
+    settings = settingsPending ? pendingSettings : cameraSettings;
+    portEXIT_CRITICAL(&settingsMux);
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+    {
+        if (httpd_query_key_value(query, "framesize", value, sizeof(value)) == ESP_OK)
+        {
+            framesize_t size;
+            if (!parseFrameSize(value, &size) || size > cameraMaxFrameSize)
+            {
+                httpd_resp_set_status(req, "400 Bad Request");
+                return httpd_resp_send(req, "{\"status\":\"error\",\"message\":\"Unsupported framesize\"}", -1);
+            }
+            settings.frameSize = size;
+            changed = true;
+        }
+        if (httpd_query_key_value(query, "quality", value, sizeof(value)) == ESP_OK)
+        {
+            settings.quality = constrain(atoi(value), 10, 63);
+            changed = true;
+        }
+        if (httpd_query_key_value(query, "xclk", value, sizeof(value)) == ESP_OK)
+        {
+            settings.xclkMhz = constrain(atoi(value), 8, 20);
+            changed = true;
+        }
+        if (httpd_query_key_value(query, "brightness", value, sizeof(value)) == ESP_OK)
+        {
+            settings.brightness = constrain(atoi(value), -2, 2);
+            changed = true;
+        }
+        if (httpd_query_key_value(query, "gain", value, sizeof(value)) == ESP_OK)
+        {
+            settings.gain = constrain(atoi(value), -1, 30);
+            changed = true;
+        }
+        if (httpd_query_key_value(query, "fps", value, sizeof(value)) == ESP_OK)
+        {
+            settings.fpsCap = constrain(atoi(value), 0, 60);
+            changed = true;
+        }
+        if (httpd_query_key_value(query, "adaptive", value, sizeof(value)) == ESP_OK)
+        {
+            settings.adaptive = strcmp(value, "1") == 0 || strcmp(value, "true") == 0;
+            changed = true;
+        }
+        if (httpd_query_key_value(query, "motion", value, sizeof(value)) == ESP_OK)
+        {
+            settings.motion = strcmp(value, "1") == 0 || strcmp(value, "true") == 0;
+            changed = true;
+        }
+        if (httpd_query_key_value(query, "roi", value, sizeof(value)) == ESP_OK)
+        {
+            RoiRect rect;
+            if (strcmp(value, "off") == 0)
+            {
+                settings.roiMode = ROI_OFF;
+            }
+            else if (strcmp(value, "motion") == 0)
+            {
+                settings.roiMode = ROI_MOTION;
+            }
+            else if (sscanf(value, "%d,%d,%d,%d", &rect.x, &rect.y, &rect.w, &rect.h) == 4 &&
+                     rect.x >= 0 && rect.y >= 0 && rect.w > 0 && rect.h > 0)
+            {
+                settings.roiMode = ROI_RECT;
+                settings.roi = rect;
+            }
+            else
+            {
+                httpd_resp_set_status(req, "400 Bad Request");
+                return httpd_resp_send(req, "{\"status\":\"error\",\"message\":\"roi must be off, motion or x,y,w,h\"}", -1);
+            }
+            changed = true;
+        }
+    }
+
+    if (changed)
+    {
+        portENTER_CRITICAL(&settingsMux);
+        pendingSettings = settings;
+        settingsPending = true;
+        portEXIT_CRITICAL(&settingsMux);
+
+        if (captureTaskHandle)
+        {
+            xTaskNotifyGive(captureTaskHandle);
+        }
+        cameraSettingsSave(settings);
+    }
+
+    int len = snprintf(json, sizeof(json),
+                       "{\"status\":\"%s\",\"framesize\":\"%s\",\"max_framesize\":\"%s\",\"quality\":%d,"
+                       "\"xclk\":%d,\"brightness\":%d,\"gain\":%d,\"fps\":%d,\"adaptive\":%s,\"motion\":%s,"
+                       "\"roi\":{\"mode\":\"%s\",\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d,\"supported\":%s}}",
+                       changed ? "updated" : "ok", frameSizeName(settings.frameSize),
+                       frameSizeName(cameraMaxFrameSize), settings.quality, settings.xclkMhz,
+                       settings.brightness, settings.gain, settings.fpsCap,
+                       settings.adaptive ? "true" : "false", settings.motion ? "true" : "false",
+                       settings.roiMode == ROI_RECT ? "rect" : settings.roiMode == ROI_MOTION ? "motion" : "off",
+                       settings.roi.x, settings.roi.y, settings.roi.w, settings.roi.h,
+                       psramFound() ? "true" : "false");
+
+    return httpd_resp_send(req, json, len);
+}
+
+// **bench handler: FPS/size/encode/loopback sweep, ?frames=N per point**
+// Live streams stall while it runs and may time out and reconnect.
+static esp_err_t bench_handler(httpd_req_t *req)
+{
+    char query[32];
+    char value[8];
+    int frames = BENCH_DEFAULT_FRAMES;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "frames", value, sizeof(value)) == ESP_OK)
+    {
+        frames = constrain(atoi(value), 2, BENCH_MAX_FRAMES);
+    }
+
+    if (benchActive)
+    {
+        setCORSHeaders(req);
+        httpd_resp_set_status(req, "409 Conflict");
+        return httpd_resp_send(req, "Benchmark already running", -1);
+    }
+
+    httpd_req_t *async_req = NULL;
+    if (httpd_req_async_handler_begin(req, &async_req) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+
+    benchActive = true;
+    benchFrames = frames;
+    noteActivity();
+    if (xTaskCreatePinnedToCore(bench_task, "bench", 8192, async_req, 4, NULL, CAMERA_CORE) != pdPASS)
+    {
+        Serial.println("Benchmark task creation failed");
+        benchActive = false;
+        httpd_req_async_handler_complete(async_req);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
 static esp_err_t options_handler(httpd_req_t *req)
 {
     setCORSHeaders(req);
@@ -206,22 +2917,182 @@ static esp_err_t options_handler(httpd_req_t *req)
 
 void startCameraServer()
 {
+    for (int i = 0; i < MAX_WS_CLIENTS; i++)
+    {
+        wsClients[i].fd = -1;
+    }
+
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.server_port = 80;
+    config.server_port = CONTROL_PORT;
+    config.max_uri_handlers = 16;
+    config.core_id = CONTROL_CORE;
+    config.task_priority = CONTROL_HTTPD_PRIORITY;
+    config.max_open_sockets = CONTROL_MAX_SOCKETS;
+    config.lru_purge_enable = true;
+
+    httpd_config_t stream_config = HTTPD_DEFAULT_CONFIG();
+    stream_config.server_port = STREAM_PORT;
+    stream_config.ctrl_port = config.ctrl_port + 1;
+    stream_config.core_id = CAMERA_CORE;
+    stream_config.task_priority = STREAM_HTTPD_PRIORITY;
+    stream_config.max_open_sockets = STREAM_MAX_SOCKETS;
 
     httpd_uri_t stream_uri = {.uri = "/stream", .method = HTTP_GET, .handler = stream_handler, .user_ctx = NULL};
     httpd_uri_t control_uri = {.uri = "/control", .method = HTTP_GET, .handler = control_handler, .user_ctx = NULL};
     httpd_uri_t capture_uri = {.uri = "/capture", .method = HTTP_GET, .handler = capture_handler, .user_ctx = NULL};
+    httpd_uri_t health_uri = {.uri = "/health", .method = HTTP_GET, .handler = health_handler, .user_ctx = NULL};
+    httpd_uri_t metrics_uri = {.uri = "/metrics", .method = HTTP_GET, .handler = metrics_handler, .user_ctx = NULL};
+    httpd_uri_t config_uri = {.uri = "/config", .method = HTTP_GET, .handler = config_handler, .user_ctx = NULL};
+    httpd_uri_t bench_uri = {.uri = "/bench", .method = HTTP_GET, .handler = bench_handler, .user_ctx = NULL};
     httpd_uri_t options_uri = {.uri = "/*", .method = HTTP_OPTIONS, .handler = options_handler, .user_ctx = NULL};
+    httpd_uri_t ws_uri = {.uri = "/ws", .method = HTTP_GET, .handler = ws_handler, .user_ctx = NULL, .is_websocket = true};
 
     Serial.printf("Starting web server on port: '%d'\n", config.server_port);
     if (httpd_start(&camera_httpd, &config) == ESP_OK)
     {
-        httpd_register_uri_handler(camera_httpd, &stream_uri);
         httpd_register_uri_handler(camera_httpd, &control_uri);
         httpd_register_uri_handler(camera_httpd, &capture_uri);
+        httpd_register_uri_handler(camera_httpd, &health_uri);
+        httpd_register_uri_handler(camera_httpd, &metrics_uri);
+        httpd_register_uri_handler(camera_httpd, &config_uri);
+        httpd_register_uri_handler(camera_httpd, &bench_uri);
         httpd_register_uri_handler(camera_httpd, &options_uri);
     }
+
+    Serial.printf("Starting stream server on port: '%d'\n", stream_config.server_port);
+    if (httpd_start(&stream_httpd, &stream_config) == ESP_OK)
+    {
+        httpd_register_uri_handler(stream_httpd, &stream_uri);
+        httpd_register_uri_handler(stream_httpd, &ws_uri);
+        httpd_register_uri_handler(stream_httpd, &options_uri);
+    }
+}
+
+// **WiFi: cached fast connect and reconnect state machine**
+// A successful connection stores the AP's BSSID and channel plus the leased
+// address in NVS. The next connect joins that AP directly with a static
+// config, skipping the scan and the DHCP round trip; if that fails once the
+// cache is dropped and a regular connect refreshes it. The HTTP servers stay
+// up across reconnects since they listen on any address.
+struct WifiCache
+{
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+};
+
+Preferences wifiPrefs;
+
+bool wifiCacheLoad(WifiCache *cache)
+{
+    wifiPrefs.begin("wifi", true);
+    bool valid = wifiPrefs.getBytes("cache", cache, sizeof(*cache)) == sizeof(*cache);
+    wifiPrefs.end();
+    return valid && cache->channel != 0 && cache->ip != 0;
+}
+
+void wifiCacheSave()
+{
+    WifiCache cache;
+    WifiCache stored;
+    memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+    cache.channel = WiFi.channel();
+    cache.ip = WiFi.localIP();
+    cache.gateway = WiFi.gatewayIP();
+    cache.subnet = WiFi.subnetMask();
+    cache.dns = WiFi.dnsIP();
+
+    // NVS writes wear the flash; skip them when nothing changed
+    if (wifiCacheLoad(&stored) && memcmp(&stored, &cache, sizeof(cache)) == 0)
+    {
+        return;
+    }
+    wifiPrefs.begin("wifi", false);
+    wifiPrefs.putBytes("cache", &cache, sizeof(cache));
+    wifiPrefs.end();
+}
+
+void wifiCacheClear()
+{
+    wifiPrefs.begin("wifi", false);
+    wifiPrefs.remove("cache");
+    wifiPrefs.end();
+}
+
+void wifiStartConnect(unsigned long now)
+{
+    WifiCache cache;
+    WiFi.disconnect();
+
+    if (wifiCacheLoad(&cache))
+    {
+        WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+        WiFi.begin(ssid, password, cache.channel, cache.bssid);
+        wifiState = WIFI_FAST_CONNECT;
+    }
+    else
+    {
+        WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE); // back to DHCP
+        WiFi.begin(ssid, password);
+        wifiState = WIFI_FULL_CONNECT;
+    }
+    wifiStateStart = now;
+}
+
+void wifiUpdate(unsigned long now)
+{
+    bool connected = WiFi.status() == WL_CONNECTED;
+
+    switch (wifiState)
+    {
+    case WIFI_FAST_CONNECT:
+    case WIFI_FULL_CONNECT:
+        if (connected)
+        {
+            Serial.printf("WiFi connected in %lu ms (%s): %s\n", now - wifiStateStart,
+                          wifiState == WIFI_FAST_CONNECT ? "cached" : "scan", WiFi.localIP().toString().c_str());
+            Serial.printf("Stream: http://%s:%d/stream\n", WiFi.localIP().toString().c_str(), STREAM_PORT);
+            Serial.printf("Control: http://%s/control?action=open\n", WiFi.localIP().toString().c_str());
+            wifiCacheSave();
+            wifiBackoffMs = 0;
+            wifiState = WIFI_CONNECTED;
+        }
+        else if (wifiState == WIFI_FAST_CONNECT && now - wifiStateStart >= WIFI_FAST_TIMEOUT_MS)
+        {
+            // AP moved channel or the address went stale
+            Serial.println("WiFi fast connect failed, scanning");
+            wifiCacheClear();
+            wifiStartConnect(now);
+        }
+        else if (wifiState == WIFI_FULL_CONNECT && now - wifiStateStart >= WIFI_FULL_TIMEOUT_MS)
+        {
+            wifiBackoffMs = wifiBackoffMs ? min(wifiBackoffMs * 2, WIFI_BACKOFF_MAX_MS) : WIFI_BACKOFF_MIN_MS;
+            Serial.printf("WiFi connection failed, retrying in %lu ms\n", wifiBackoffMs);
+            WiFi.disconnect();
+            wifiState = WIFI_BACKOFF;
+            wifiStateStart = now;
+        }
+        break;
+
+    case WIFI_CONNECTED:
+        if (!connected)
+        {
+            Serial.println("WiFi connection lost, reconnecting");
+            wifiReconnects++;
+            wifiStartConnect(now);
+        }
+        break;
+
+    case WIFI_BACKOFF:
+        if (now - wifiStateStart >= wifiBackoffMs)
+        {
+            wifiStartConnect(now);
+        }
+        break;
+    }
 }
 
 void setup()
@@ -238,28 +3109,14 @@ void setup()
     digitalWrite(FLASH_LED_PIN, LOW);
     digitalWrite(BUZZER_PIN, LOW);
     digitalWrite(RELAY_PIN, LOW);
+    gpio_hold_dis((gpio_num_t)RELAY_PIN); // held low through deep sleep
 
-    // **WiFi connection with timeout**
-    WiFi.begin(ssid, password);
-    Serial.print("Connecting to WiFi");
-    unsigned long wifiStart = millis();
-    while (WiFi.status() != WL_CONNECTED && millis() - wifiStart < 15000)
-    {
-        delay(500);
-        Serial.print(".");
-    }
-
-    if (WiFi.status() == WL_CONNECTED)
-    {
-        Serial.println(" connected!");
-        Serial.print("Camera IP: ");
-        Serial.println(WiFi.localIP());
-    }
-    else
-    {
-        Serial.println(" connection failed!");
-        return;
-    }
+    // **WiFi: connects in the background while the camera initializes**
+    // loop() owns reconnects; the driver's own auto-reconnect would race it.
+    WiFi.persistent(false);
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(false);
+    wifiStartConnect(millis());
 
     // **Camera configuration**
     camera_config_t config;
@@ -281,21 +3138,31 @@ void setup()
     config.pin_sccb_scl = SIOC_GPIO_NUM;
     config.pin_pwdn = PWDN_GPIO_NUM;
     config.pin_reset = RESET_GPIO_NUM;
-    config.xclk_freq_hz = 20000000;
     config.pixel_format = PIXFORMAT_JPEG;
 
+    // **PSRAM: multi-buffered capture so the sensor never waits on WiFi**
+    // Buffers are sized for the largest frame /config may switch to.
     if (psramFound())
     {
-        config.frame_size = FRAMESIZE_VGA;
-        config.jpeg_quality = 15;
-        config.fb_count = 1;
+        cameraMaxFrameSize = FRAMESIZE_SVGA;
+        config.fb_count = CAMERA_FB_COUNT_PSRAM;
+        config.fb_location = CAMERA_FB_IN_PSRAM;
+        config.grab_mode = CAMERA_GRAB_LATEST;
     }
     else
     {
-        config.frame_size = FRAMESIZE_QVGA;
-        config.jpeg_quality = 20;
+        cameraMaxFrameSize = FRAMESIZE_QVGA;
         config.fb_count = 1;
+        config.fb_location = CAMERA_FB_IN_DRAM;
+        config.grab_mode = CAMERA_GRAB_WHEN_EMPTY;
     }
+    cameraFbCount = config.fb_count;
+
+    CameraSettings settings;
+    cameraSettingsLoad(&settings, psramFound());
+    config.frame_size = cameraMaxFrameSize;
+    config.jpeg_quality = settings.quality;
+    config.xclk_freq_hz = settings.xclkMhz * 1000000;
 
     if (esp_camera_init(&config) != ESP_OK)
     {
@@ -303,17 +3170,65 @@ void setup()
         return;
     }
 
+    cameraConfig = config;
+    cameraSettings = settings;
+    cameraApplySettings(settings);
+
+    frameSlots = xSemaphoreCreateCounting(cameraFbCount, cameraFbCount);
+    benchParked = xSemaphoreCreateBinary();
+    benchResume = xSemaphoreCreateBinary();
+    xTaskCreatePinnedToCore(capture_task, "capture", 4096, NULL, 6, &captureTaskHandle, CAMERA_CORE);
+    uploadQueue = xQueueCreate(UPLOAD_QUEUE_LENGTH, sizeof(UploadJob));
+    uploadTriggers = xEventGroupCreate();
+    xTaskCreatePinnedToCore(upload_task, "upload", 4096, NULL, 4, NULL, CONTROL_CORE);
+    xTaskCreatePinnedToCore(upload_sender_task, "upload_send", 8192, NULL, 3, NULL, CONTROL_CORE);
+    xTaskCreatePinnedToCore(motion_task, "motion", 4096, NULL, 3, NULL, CAMERA_CORE);
+    xTaskCreatePinnedToCore(ws_push_task, "ws_push", 4096, NULL, STREAM_HTTPD_PRIORITY, &wsTaskHandle, CAMERA_CORE);
+
     startCameraServer();
 
+    // Woken from deep sleep by the doorbell: that press still counts
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT0)
+    {
+        Serial.println("Woken by doorbell button");
+        requestUpload(UPLOAD_TRIGGER_BUTTON);
+    }
+
     Serial.println("Setup complete!");
-    Serial.printf("Stream: http://%s/stream\n", WiFi.localIP().toString().c_str());
-    Serial.printf("Control: http://%s/control?action=open\n", WiFi.localIP().toString().c_str());
 }
 
 void loop()
 {
     unsigned long currentTime = millis();
 
+    wifiUpdate(currentTime);
+
+    // **door state machine**
+    // Requests that arrive while the door is already opening merge into the
+    // current cycle; a request while open restarts the hold time.
+    if (doorOpenRequested.exchange(false))
+    {
+        if (doorState == DOOR_IDLE)
+        {
+            digitalWrite(BUZZER_PIN, HIGH);
+            digitalWrite(RELAY_PIN, HIGH);
+            doorState = DOOR_UNLOCKING;
+            doorStateStart = currentTime;
+        }
+        else if (doorState == DOOR_OPEN)
+        {
+            relayStartTime = currentTime;
+        }
+    }
+
+    if (doorState == DOOR_UNLOCKING && currentTime - doorStateStart >= DOOR_UNLOCK_DELAY)
+    {
+        digitalWrite(FLASH_LED_PIN, HIGH);
+        relayStartTime = currentTime;
+        relayActive = true;
+        doorState = DOOR_OPEN;
+    }
+
     // **relay control**
     if (relayActive && (currentTime - relayStartTime >= RELAY_DURATION))
     {
@@ -321,6 +3236,23 @@ void loop()
         digitalWrite(RELAY_PIN, LOW);
         digitalWrite(FLASH_LED_PIN, LOW);
         relayActive = false;
+        doorState = DOOR_IDLE;
         Serial.println("Relay deactivated");
     }
+
+    // **doorbell button**
+    int buttonState = digitalRead(BUTTON_PIN);
+    if (buttonState == LOW && lastButtonState == HIGH && currentTime - lastButtonPress >= BUTTON_DEBOUNCE)
+    {
+        lastButtonPress = currentTime;
+        Serial.println("Doorbell button pressed");
+        requestUpload(UPLOAD_TRIGGER_BUTTON);
+    }
+    lastButtonState = buttonState;
+
+    // **idle deep sleep** once the camera is down and the door is closed
+    if (IDLE_DEEP_SLEEP && cameraAsleep && doorState == DOOR_IDLE && uxQueueMessagesWaiting(uploadQueue) == 0)
+    {
+        enterDeepSleep();
+    }
 }
\ No newline at end of file
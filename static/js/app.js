@@ -96,6 +96,115 @@ const ApiManager = {
     }
 };
 
+// Access history kept client-side; after the first page only records added
+// or changed since the last seen version are fetched
+const AccessHistoryCache = {
+    records: new Map(),
+    version: null,
+
+    async sync() {
+        if (this.version === null) {
+            const page = await ApiManager.request('/api/access-history');
+            page.records.forEach(record => this.records.set(record.id, record));
+            this.version = page.version;
+            return;
+        }
+
+        let page;
+        do {
+            page = await ApiManager.request(`/api/access-history?since=${this.version}&limit=500`);
+            page.records.forEach(record => this.records.set(record.id, record));
+            this.version = page.version;
+        } while (page.has_more);
+    },
+
+    list() {
+        return [...this.records.values()].sort((a, b) => b.seq - a.seq);
+    }
+};
+
+// History list paging. Without filters it pages through /api/history, which
+// hands back the query parameters of the next page; with a date or status
+// filter it pages through the matching access records, filtered by the
+// server. Refreshes reload the newest page and keep older pages loaded.
+const HistoryPager = {
+    items: [],
+    cursor: null, // next-page params for /api/history, or a record seq
+    hasMore: false,
+
+    filters() {
+        return {
+            date: document.getElementById('date-filter').value,
+            status: document.getElementById('status-filter').value
+        };
+    },
+
+    fromRecord(record) {
+        const timestamp = new Date(record.timestamp);
+        return {
+            filename: record.filename,
+            url: record.image_url,
+            thumb_url: record.thumb_url,
+            date: timestamp.toLocaleDateString('ro-RO'),
+            time: timestamp.toLocaleTimeString('ro-RO'),
+            record
+        };
+    },
+
+    async fetchPage(before) {
+        const { date, status } = this.filters();
+
+        if (!date && status === 'all') {
+            const params = new URLSearchParams({ limit: HISTORY_PAGE_SIZE, ...(before || {}) });
+            const page = await ApiManager.request(`/api/history?${params}`);
+            return { items: page.items, cursor: page.next, hasMore: page.has_more };
+        }
+
+        const params = new URLSearchParams({ limit: HISTORY_PAGE_SIZE });
+        if (status !== 'all') params.set('status', status);
+        if (date) {
+            // Record timestamps are local ISO strings, so the day is [date, next day)
+            const [year, month, day] = date.split('-').map(Number);
+            params.set('from', date);
+            params.set('to', new Date(Date.UTC(year, month - 1, day + 1)).toISOString().split('T')[0]);
+        }
+        if (before) params.set('before', before);
+
+        const page = await ApiManager.request(`/api/access-history?${params}`);
+        return {
+            items: page.records.map(record => this.fromRecord(record)),
+            cursor: page.next_before,
+            hasMore: page.has_more
+        };
+    },
+
+    async refresh() {
+        const page = await this.fetchPage(null);
+        if (this.items.length <= page.items.length) {
+            Object.assign(this, page);
+            return;
+        }
+
+        const fresh = new Set(page.items.map(item => item.filename));
+        this.items = page.items.concat(this.items.filter(item => !fresh.has(item.filename)));
+    },
+
+    async reset() {
+        this.items = [];
+        this.cursor = null;
+        this.hasMore = false;
+        await this.refresh();
+    },
+
+    async loadOlder() {
+        if (!this.hasMore) return;
+        const page = await this.fetchPage(this.cursor);
+        this.items = this.items.concat(page.items);
+        this.cursor = page.cursor;
+        this.hasMore = page.hasMore;
+    }
+};
+
 // UI update manager
 const UIUpdateManager = {
     async updateAll() {
@@ -116,13 +225,15 @@ const UIUpdateManager = {
 
     async updateHistory() {
         try {
-            const [historyData, accessData] = await Promise.all([
-                ApiManager.request('/api/history'),
-                ApiManager.request('/api/access-history')
+            const [, stats] = await Promise.all([
+                HistoryPager.refresh(),
+                ApiManager.request('/api/access-history/stats'),
+                AccessHistoryCache.sync()
             ]);
-            updateHistoryView(historyData, accessData);
+            const accessData = AccessHistoryCache.list();
+            updateHistoryView(HistoryPager.items, accessData);
             updateRecentActivityWithRealData(accessData.slice(0, 5));
-            updateStatsWithRealData(accessData);
+            updateStatsWithRealData(stats);
         } catch (error) {
             console.error('Error updating history:', error);
         }
@@ -171,9 +282,11 @@ const PerformanceUtils = {
 // ==================== GLOBAL VARIABLES ====================
 
 let cameraIP = '';
+const HISTORY_PAGE_SIZE = 50;
+let selectedDeviceId = null; // camera shown in the main stream; null = server default
+let cameraDevices = [];
+const STREAM_PORT = 81; // ESP32 serves /stream on its own httpd instance
 let streamConnected = false;
-let faceDetectionInterval = null;
-let isDetecting = false;
 
 // ==================== INITIALIZATION ====================
 
@@ -184,21 +297,119 @@ document.addEventListener('DOMContentLoaded', function () {
     initSSE();
     attachEventListeners();
     initVideoStream();
+    initStreamFaceDetection();
     initFaceManagement();
 });
 
 // ==================== VIDEO STREAM MANAGEMENT ====================
 
-function initVideoStream() {
-    const savedCameraIP = "192.168.0.100";
-    cameraIP = savedCameraIP;
+async function initVideoStream() {
+    try {
+        cameraDevices = await ApiManager.request('/api/devices');
+    } catch (error) {
+        console.error('Error loading cameras:', error);
+    }
+
+    const savedDeviceId = localStorage.getItem('cameraDevice');
+    const device = cameraDevices.find(d => d.id === savedDeviceId) || cameraDevices[0];
+
+    if (device) {
+        selectCamera(device.id);
+    } else {
+        // Server unreachable: fall back to the factory address
+        cameraIP = "192.168.0.100";
+        document.getElementById('camera-ip-setting').value = cameraIP;
+        document.getElementById('camera-ip').textContent = cameraIP;
+        startVideoStream();
+    }
+
+    setInterval(refreshCameraGrid, 10000);
+}
+
+// ==================== CAMERA GRID ====================
+
+function selectCamera(deviceId) {
+    const device = cameraDevices.find(d => d.id === deviceId);
+    if (!device) return;
+
+    selectedDeviceId = device.id;
+    cameraIP = device.ip;
+    localStorage.setItem('cameraDevice', device.id);
 
     document.getElementById('camera-ip-setting').value = cameraIP;
-    document.getElementById('camera-ip').textContent = cameraIP;
+    document.getElementById('camera-ip').textContent = `${cameraIP} (${device.name})`;
 
+    renderCameraGrid();
     startVideoStream();
 }
 
+function renderCameraGrid() {
+    const grid = document.getElementById('camera-grid');
+    if (!grid) return;
+    grid.innerHTML = '';
+
+    if (cameraDevices.length === 0) {
+        grid.innerHTML = '<p class="empty-state">Nu există camere configurate.</p>';
+        return;
+    }
+
+    cameraDevices.forEach(device => {
+        const tile = document.createElement('div');
+        const isSelected = device.id === selectedDeviceId;
+        tile.className = `camera-tile ${isSelected ? 'selected' : ''}`;
+        tile.dataset.device = device.id;
+
+        // The selected camera already streams above; don't open a second connection to it
+        const preview = isSelected ?
+            '<div class="camera-tile-preview camera-tile-placeholder">Afișată mai sus</div>' :
+            `<img class="camera-tile-preview" src="${device.stream_url}" alt="${device.name}" loading="lazy">`;
+
+        tile.innerHTML = `
+            ${preview}
+            <div class="camera-tile-info">
+                <h5>${device.name}</h5>
+                <span class="video-status camera-tile-status"></span>
+            </div>
+        `;
+
+        tile.addEventListener('click', () => {
+            if (!isSelected) selectCamera(device.id);
+        });
+        grid.appendChild(tile);
+    });
+
+    updateCameraGridStatus();
+}
+
+function updateCameraGridStatus() {
+    cameraDevices.forEach(device => {
+        const status = document.querySelector(`.camera-tile[data-device="${device.id}"] .camera-tile-status`);
+        if (!status) return;
+
+        const online = device.health && device.health.online;
+        status.className = `video-status camera-tile-status ${online ? 'status-online' : 'status-offline'}`;
+        status.innerHTML = `<i class="fas fa-circle"></i> ${online ? 'Online' : 'Offline'}`;
+    });
+}
+
+// Health comes from the server's pollers, so only the badges are refreshed
+async function refreshCameraGrid() {
+    try {
+        const devices = await ApiManager.request('/api/devices');
+        const changed = devices.length !== cameraDevices.length ||
+            devices.some((d, i) => d.id !== cameraDevices[i].id || d.ip !== cameraDevices[i].ip);
+
+        cameraDevices = devices;
+        if (changed) {
+            renderCameraGrid();
+        } else {
+            updateCameraGridStatus();
+        }
+    } catch (error) {
+        console.error('Error refreshing cameras:', error);
+    }
+}
+
 function startVideoStream() {
     if (!cameraIP) {
         updateStreamStatus('Configurează IP-ul camerei în setări', false);
@@ -207,7 +418,7 @@ function startVideoStream() {
 
     const videoElement = document.getElementById('video-stream');
     const loadingOverlay = document.getElementById('loading-overlay');
-    const streamUrl = `http://${cameraIP}/stream`;
+    const streamUrl = `http://${cameraIP}:${STREAM_PORT}/stream`;
 
     loadingOverlay.style.display = 'flex';
     videoElement.src = streamUrl;
@@ -231,14 +442,16 @@ function startVideoStream() {
 const throttledHealthCheck = PerformanceUtils.throttle(function checkStreamHealth() {
     if (!streamConnected) return;
 
-    const testImg = new Image();
-    testImg.onload = () => updateStreamStatus('Online', true);
-    testImg.onerror = () => {
-        updateStreamStatus('Conexiune pierdută', false);
-        streamConnected = false;
-        setTimeout(startVideoStream, 2000);
-    };
-    testImg.src = `http://${cameraIP}/capture?t=${Date.now()}`;
+    fetch(`http://${cameraIP}/health`, { cache: 'no-store' })
+        .then(response => {
+            if (!response.ok) throw new Error(`HTTP error! status: ${response.status}`);
+            updateStreamStatus('Online', true);
+        })
+        .catch(() => {
+            updateStreamStatus('Conexiune pierdută', false);
+            streamConnected = false;
+            setTimeout(startVideoStream, 2000);
+        });
 }, 5000);
 
 function updateStreamStatus(message, isOnline) {
@@ -265,7 +478,7 @@ async function openDoor() {
 
     try {
         await StreamManager.pauseAndExecute(videoElement, async () => {
-            const data = await ApiManager.post('/api/door/open');
+            const data = await ApiManager.postJson('/api/door/open', { device: selectedDeviceId });
             if (!data.success) {
                 showNotification('❌ Eroare: ' + data.message, 'error');
             }
@@ -437,6 +650,7 @@ function showNotification(message, type = 'info') {
 function updateHistoryView(data, accessData = []) {
     const historyList = document.getElementById('history-list');
     historyList.innerHTML = '';
+    document.getElementById('history-load-more').hidden = !HistoryPager.hasMore;
 
     if (data.length === 0) {
         historyList.innerHTML = '<p class="empty-state">Nu există înregistrări în istoric.</p>';
@@ -447,11 +661,12 @@ function updateHistoryView(data, accessData = []) {
         const historyItem = document.createElement('div');
         historyItem.className = 'history-item';
 
-        const accessRecord = accessData.find(record => record.filename === item.filename);
+        // The cache only covers recent records; older pages carry their own
+        const accessRecord = accessData.find(record => record.filename === item.filename) || item.record;
         const { visitorName, statusClass, statusText, methodText } = getVisitorInfo(accessRecord);
 
         historyItem.innerHTML = `
-            <img src="${item.url}" alt="Vizitator" data-filename="${item.filename}">
+            <img src="${item.thumb_url || item.url}" alt="Vizitator" data-filename="${item.filename}" loading="lazy">
             <div class="history-info">
                 <h4 class="${statusClass === 'status-granted' ? 'known-visitor' : 'unknown-visitor'}">${visitorName}</h4>
                 <p>Data: ${item.date}</p>
@@ -484,7 +699,7 @@ function updateRecentActivityWithRealData(accessData) {
         const { visitorName, statusClass, statusText, methodText } = getVisitorInfo(item);
 
         activityItem.innerHTML = `
-            <img src="${item.image_url}" alt="Vizitator" onclick="openImageModal('${item.image_url}', '${item.filename}')">
+            <img src="${item.thumb_url || item.image_url}" alt="Vizitator" loading="lazy" onclick="openImageModal('${item.image_url}', '${item.filename}')">
             <div class="activity-details">
                 <p><strong>${visitorName}</strong></p>
                 <p>${methodText}</p>
@@ -497,18 +712,10 @@ function updateRecentActivityWithRealData(accessData) {
     });
 }
 
-function updateStatsWithRealData(accessData) {
-    document.getElementById('total-visits').textContent = accessData.length;
-
-    const today = DateTimeUtils.getTodayString();
-    const todayVisits = accessData.filter(item =>
-        DateTimeUtils.isSameDay(item.timestamp, today)
-    ).length;
-
-    document.getElementById('today-visits').textContent = todayVisits;
-
-    const deniedVisits = accessData.filter(item => item.status === 'denied').length;
-    document.getElementById('denied-visits').textContent = deniedVisits;
+function updateStatsWithRealData(stats) {
+    document.getElementById('total-visits').textContent = stats.total;
+    document.getElementById('today-visits').textContent = stats.today;
+    document.getElementById('denied-visits').textContent = stats.denied;
 }
 
 function getVisitorInfo(accessRecord) {
@@ -597,7 +804,10 @@ async function grantAccess(filename) {
             if (data.success) {
                 showNotification('✅ Acces permis cu succes!', 'success');
 
-                const doorData = await ApiManager.post('/api/door/open');
+                // Open the door of the camera that took the picture
+                const record = AccessHistoryCache.list().find(r => r.filename === filename);
+                const device = (record && record.device_id) || selectedDeviceId;
+                const doorData = await ApiManager.postJson('/api/door/open', { device });
                 if (doorData.success) {
                     showNotification('🚪 Ușa a fost deschisă cu succes!', 'success');
                 } else {
@@ -634,13 +844,13 @@ async function captureImage(type = 'manual', name = null) {
     ButtonManager.setLoading(button, 'Se capturează...');
 
     const endpoint = type === 'manual' ? '/take_photo' : '/api/faces/add';
-    const payload = type === 'face' ? { name, source: 'capture' } : null;
+    const payload = type === 'face' ?
+        { name, source: 'capture', device: selectedDeviceId } :
+        { device: selectedDeviceId };
 
     try {
         await StreamManager.pauseAndExecute(videoElement, async () => {
-            const data = payload ?
-                await ApiManager.postJson(endpoint, payload) :
-                await ApiManager.post(endpoint);
+            const data = await ApiManager.postJson(endpoint, payload);
 
             if (data.success) {
                 showNotification(`✅ ${data.message}`, 'success');
@@ -687,46 +897,39 @@ function updateCapturePreview(data) {
 
 // ==================== FACE DETECTION IN STREAM ====================
 
-const throttledStreamDetection = PerformanceUtils.throttle(function detectFaceInStream() {
-    if (isDetecting || !streamConnected || !cameraIP) return;
+// Detection runs on the server, on its own connection to the camera stream;
+// the dashboard only switches it on or off and reacts to its SSE events
 
-    isDetecting = true;
+async function initStreamFaceDetection() {
+    const autoDetectionToggle = document.getElementById('auto-detection-toggle');
+    if (!autoDetectionToggle) return;
+
+    try {
+        const status = await ApiManager.request('/api/stream-ingest');
+        autoDetectionToggle.checked = status.enabled;
+    } catch (error) {
+        console.error('Error loading stream detection status:', error);
+    }
+}
+
+async function setStreamFaceDetection(enabled) {
+    try {
+        const status = await ApiManager.postJson('/api/stream-ingest', { enabled });
+        console.log(status.enabled ? '✅ Face detection started' : '❌ Face detection stopped');
+    } catch (error) {
+        console.error('Error switching stream detection:', error);
+    }
+}
+
+function handleStreamFaceDetected(data) {
+    // Only the camera on screen gets the overlay; the others show up in the history
+    if (data && data.device_id && selectedDeviceId && data.device_id !== selectedDeviceId) return;
 
     const videoElement = document.getElementById('video-stream');
-    const canvas = document.createElement('canvas');
-    const ctx = canvas.getContext('2d');
-
-    canvas.width = videoElement.naturalWidth || 640;
-    canvas.height = videoElement.naturalHeight || 480;
-    ctx.drawImage(videoElement, 0, 0, canvas.width, canvas.height);
-
-    canvas.toBlob(blob => {
-        if (blob) {
-            const formData = new FormData();
-            formData.append('image', blob, 'stream_frame.jpg');
-
-            ApiManager.upload('/api/detect-face-stream', formData)
-                .then(data => {
-                    // FIX: Check for face_detected instead of access_granted
-                    if (data.face_detected) {
-                        console.log(`Face detected: ${data.status}, filename: ${data.filename}`);
-
-                        // Pause stream immediately when face is detected
-                        pauseStreamForProcessing(videoElement);
-
-                        // STOP detection temporarily while processing
-                        stopDetectionTemporarily();
-                    }
-                })
-                .catch(error => console.error('Stream face detection error:', error))
-                .finally(() => {
-                    isDetecting = false;
-                });
-        } else {
-            isDetecting = false;
-        }
-    }, 'image/jpeg', 0.8);
-}, 2000);
+    if (streamConnected && !document.getElementById('face-detection-overlay').classList.contains('active')) {
+        pauseStreamForProcessing(videoElement);
+    }
+}
 
 // Pause stream when face is detected and being processed
 function pauseStreamForProcessing(videoElement) {
@@ -759,48 +962,9 @@ function pauseStreamForProcessing(videoElement) {
         videoElement.src = currentSrc;
         overlay.classList.remove('active');
         console.log('▶️ Stream resumed after face processing');
-
-        // Resume detection
-        setTimeout(() => {
-            restartDetection();
-        }, 1000);
     }, 4000);
 }
 
-// Stop detection temporarily to avoid spam
-function stopDetectionTemporarily() {
-    if (faceDetectionInterval) {
-        clearInterval(faceDetectionInterval);
-        faceDetectionInterval = null;
-        console.log('⏸️ Face detection paused temporarily');
-    }
-}
-
-// Restart detection after processing
-function restartDetection() {
-    // Only restart if the toggle is still enabled
-    const autoDetectionToggle = document.getElementById('auto-detection-toggle');
-    if (autoDetectionToggle && autoDetectionToggle.checked && !faceDetectionInterval) {
-        faceDetectionInterval = setInterval(throttledStreamDetection, 3000);
-        console.log('▶️ Face detection resumed');
-    }
-}
-
-function startStreamFaceDetection() {
-    if (faceDetectionInterval) return;
-    faceDetectionInterval = setInterval(throttledStreamDetection, 3000);
-    console.log('✅ Face detection started');
-}
-
-function stopStreamFaceDetection() {
-    if (faceDetectionInterval) {
-        clearInterval(faceDetectionInterval);
-        faceDetectionInterval = null;
-        console.log('❌ Face detection stopped');
-    }
-}
-
-
 // ==================== FACE MANAGEMENT ====================
 
 function initFaceManagement() {
@@ -861,7 +1025,7 @@ function updateKnownFacesList(faces) {
         faceItem.className = 'known-face-item';
 
         faceItem.innerHTML = `
-            <img src="${face.url}" alt="${face.name}" class="face-thumbnail">
+            <img src="${face.thumb_url || face.url}" alt="${face.name}" class="face-thumbnail" loading="lazy">
             <div class="face-info">
                 <h5>${face.name}</h5>
                 <p>Fișier: ${face.filename}</p>
@@ -926,6 +1090,7 @@ function deleteFace(filename, name) {
 const SSEHandlers = {
     'new_visitor': (data) => handleGenericVisitor(data, 'Cineva este la ușă!'),
     'manual_capture_with_recognition': (data) => handleCapture(data),
+    'stream_face_detected': (data) => handleStreamFaceDetected(data),
     'stream_face_recognized': (data) => handleStreamFace(data, true),
     'stream_face_denied': (data) => handleStreamFace(data, false),
     'access_granted_manual': (data) => handleManualGrant(data),
@@ -1043,41 +1208,22 @@ function showDesktopNotification(title, body) {
 
 // ==================== HISTORY FILTERING ====================
 
+// Filters are applied by the server, so they reach past the loaded pages
 const debouncedFilterHistory = PerformanceUtils.debounce(function filterHistory() {
-    const dateFilter = document.getElementById('date-filter').value;
-    const statusFilter = document.getElementById('status-filter').value;
-
     Promise.all([
-        ApiManager.request('/api/history'),
-        ApiManager.request('/api/access-history')
-    ]).then(([historyData, accessData]) => {
-        let filteredHistoryData = historyData;
-
-        if (dateFilter) {
-            const filterDate = new Date(dateFilter);
-            const filterDateStr = filterDate.toLocaleDateString('ro-RO');
-
-            filteredHistoryData = historyData.filter(item => {
-                const parts = item.date.split('.');
-                if (parts.length === 3) {
-                    const itemDate = new Date(parts[2], parts[1] - 1, parts[0]);
-                    return itemDate.toLocaleDateString('ro-RO') === filterDateStr;
-                }
-                return false;
-            });
-        }
-
-        if (statusFilter !== 'all') {
-            filteredHistoryData = filteredHistoryData.filter(item => {
-                const accessRecord = accessData.find(record => record.filename === item.filename);
-                return accessRecord ? accessRecord.status === statusFilter : statusFilter === 'denied';
-            });
-        }
-
-        updateHistoryView(filteredHistoryData, accessData);
+        HistoryPager.reset(),
+        AccessHistoryCache.sync()
+    ]).then(() => {
+        updateHistoryView(HistoryPager.items, AccessHistoryCache.list());
     }).catch(error => console.error('Error filtering history:', error));
 }, 300);
 
+function loadOlderHistory() {
+    HistoryPager.loadOlder()
+        .then(() => updateHistoryView(HistoryPager.items, AccessHistoryCache.list()))
+        .catch(error => console.error('Error loading older history:', error));
+}
+
 // ==================== EVENT LISTENERS ====================
 
 function attachEventListeners() {
@@ -1090,13 +1236,8 @@ function attachEventListeners() {
     const autoDetectionToggle = document.getElementById('auto-detection-toggle');
     if (autoDetectionToggle) {
         autoDetectionToggle.addEventListener('change', function () {
-            if (this.checked) {
-                startStreamFaceDetection();
-                console.log('✅ Detectare automată activată');
-            } else {
-                stopStreamFaceDetection();
-                console.log('❌ Detectare automată dezactivată');
-            }
+            setStreamFaceDetection(this.checked);
+            console.log(this.checked ? '✅ Detectare automată activată' : '❌ Detectare automată dezactivată');
         });
     }
 
@@ -1106,9 +1247,13 @@ function attachEventListeners() {
         const newCameraIP = document.getElementById('camera-ip-setting').value.trim();
         if (newCameraIP && newCameraIP !== cameraIP) {
             cameraIP = newCameraIP;
-            localStorage.setItem('cameraIP', cameraIP);
             document.getElementById('camera-ip').textContent = cameraIP;
             startVideoStream();
+
+            // The server's pipelines for this camera follow the new address
+            ApiManager.postJson('/api/settings/camera-ip', { ip: newCameraIP, device: selectedDeviceId })
+                .then(refreshCameraGrid)
+                .catch(error => console.error('Error saving camera IP:', error));
         }
         showNotification('Setările au fost salvate cu succes!', 'success');
     });
@@ -1122,6 +1267,7 @@ function attachEventListeners() {
     // History filters
     document.getElementById('date-filter').addEventListener('change', debouncedFilterHistory);
     document.getElementById('status-filter').addEventListener('change', debouncedFilterHistory);
+    document.getElementById('history-load-more').addEventListener('click', loadOlderHistory);
 }
 // ==================== GLOBAL FUNCTIONS ====================
 
@@ -1,14 +1,30 @@
 import requests
 import os
+import queue
 import threading
 import time
 import json
 from datetime import datetime
-from typing import Optional, Dict, Any
+from typing import Optional, Dict, Any, List
+
+import cv2
+import numpy as np
+
+OUTBOX_SIZE = 50  # pending messages; newer ones are dropped beyond this
+SEND_ATTEMPTS = 3
+VISITOR_COALESCE_SECONDS = 3.0  # visitor alerts this close together go out as one album
+MEDIA_GROUP_MAX = 10  # Telegram's limit for sendMediaGroup
+PHOTO_MAX_SIDE = 1024
+PHOTO_JPEG_QUALITY = 85
 
 
 class TelegramBot:
-    """Complete Telegram bot management for Smart Door system"""
+    """Complete Telegram bot management for Smart Door system
+
+    Outgoing messages are queued and delivered by a single sender thread over
+    one persistent HTTPS session, so callers on the recognition path never
+    wait on the Telegram API.
+    """
 
     def __init__(self, bot_token: str, chat_id: str, enabled: bool = True):
         self.bot_token = bot_token
@@ -21,6 +37,15 @@ class TelegramBot:
         # Door controller callback (will be set from main app)
         self.door_controller = None
 
+        # Only the sender thread uses this session; the command listener has its own
+        self.session = requests.Session()
+        self.outbox = queue.Queue(maxsize=OUTBOX_SIZE)
+        self.stats = {"sent": 0, "failed": 0, "dropped": 0, "coalesced": 0}
+        self.sender_thread = threading.Thread(
+            target=self._sender_worker, name="telegram-sender", daemon=True
+        )
+        self.sender_thread.start()
+
     def set_door_controller(self, controller_func):
         """Set the door controller function from main app"""
         self.door_controller = controller_func
@@ -29,72 +54,217 @@ class TelegramBot:
         """Check if bot is properly configured"""
         return bool(self.bot_token and self.chat_id)
 
-    def send_message(self, message: str, parse_mode: str = "HTML") -> bool:
-        """Send text message to Telegram"""
+    def _enqueue(self, item: Dict[str, Any]) -> bool:
         if not self.enabled or not self.is_configured():
             return False
 
         try:
-            url = f"https://api.telegram.org/bot{self.bot_token}/sendMessage"
-            data = {"chat_id": self.chat_id, "text": message, "parse_mode": parse_mode}
-            response = requests.post(url, json=data, timeout=10)
-
-            if response.status_code == 200:
-                print(f"[📱] Telegram message sent successfully")
-                return True
-            else:
-                print(f"[📱] Telegram API error: {response.status_code}")
-                return False
-
-        except Exception as e:
-            print(f"[📱] Telegram message failed: {e}")
+            self.outbox.put_nowait(item)
+            return True
+        except queue.Full:
+            self.stats["dropped"] += 1
+            print("[📱] Telegram outbox full, message dropped")
             return False
 
+    def send_message(self, message: str, parse_mode: str = "HTML") -> bool:
+        """Queue a text message; returns False if it could not be queued"""
+        return self._enqueue(
+            {"kind": "message", "text": message, "parse_mode": parse_mode}
+        )
+
     def send_photo(
-        self, image_path: str, caption: str = "", parse_mode: str = "HTML"
+        self,
+        image_path: Optional[str] = None,
+        caption: str = "",
+        parse_mode: str = "HTML",
+        image_data: Optional[bytes] = None,
+        coalesce: Optional[str] = None,
     ) -> bool:
-        """Send photo with caption to Telegram"""
+        """Queue a photo with caption, from a file or in-memory JPEG bytes
+
+        coalesce is a key: photos with the same key that arrive within
+        VISITOR_COALESCE_SECONDS are merged into a single album under the
+        newest caption, so only alerts that caption describes may share one.
+        """
         if not self.enabled or not self.is_configured():
             return False
 
-        if not os.path.exists(image_path):
-            print(f"[📱] Image not found: {image_path}")
-            return False
+        if image_data is None:
+            if not image_path or not os.path.exists(image_path):
+                print(f"[📱] Image not found: {image_path}")
+                return False
+            with open(image_path, "rb") as photo:
+                image_data = photo.read()
+
+        return self._enqueue(
+            {
+                "kind": "photo",
+                "photo": image_data,
+                "caption": caption,
+                "parse_mode": parse_mode,
+                "coalesce": coalesce,
+            }
+        )
 
-        try:
-            url = f"https://api.telegram.org/bot{self.bot_token}/sendPhoto"
+    @staticmethod
+    def _prepare_photo(image_data: bytes) -> bytes:
+        """Downscale large captures before upload; small ones are sent as-is"""
+        image = cv2.imdecode(np.frombuffer(image_data, np.uint8), cv2.IMREAD_COLOR)
+        if image is None:
+            return image_data
+
+        height, width = image.shape[:2]
+        scale = PHOTO_MAX_SIDE / max(height, width)
+        if scale >= 1:
+            return image_data
+
+        image = cv2.resize(
+            image,
+            (round(width * scale), round(height * scale)),
+            interpolation=cv2.INTER_AREA,
+        )
+        ok, encoded = cv2.imencode(
+            ".jpg", image, [cv2.IMWRITE_JPEG_QUALITY, PHOTO_JPEG_QUALITY]
+        )
+        return encoded.tobytes() if ok else image_data
 
-            with open(image_path, "rb") as photo:
-                files = {"photo": photo}
-                data = {
+    def _post(self, method: str, data: Dict[str, Any], files=None) -> bool:
+        """Call a Bot API method, retrying on network errors and rate limits"""
+        url = f"https://api.telegram.org/bot{self.bot_token}/{method}"
+
+        for attempt in range(1, SEND_ATTEMPTS + 1):
+            try:
+                if files:
+                    response = self.session.post(url, data=data, files=files, timeout=15)
+                else:
+                    response = self.session.post(url, json=data, timeout=10)
+
+                if response.status_code == 200:
+                    return True
+
+                if response.status_code == 429:
+                    # Telegram says how long to back off
+                    retry_after = (
+                        response.json().get("parameters", {}).get("retry_after", 1)
+                    )
+                    print(f"[📱] Telegram rate limit, retrying in {retry_after}s")
+                    time.sleep(retry_after)
+                    continue
+
+                print(f"[📱] Telegram API error ({method}): {response.status_code}")
+                if response.status_code < 500:
+                    return False
+
+            except requests.exceptions.RequestException as e:
+                print(f"[📱] Telegram {method} failed (attempt {attempt}): {e}")
+
+            time.sleep(attempt)
+
+        return False
+
+    def _deliver_message(self, item: Dict[str, Any]) -> bool:
+        return self._post(
+            "sendMessage",
+            {
+                "chat_id": self.chat_id,
+                "text": item["text"],
+                "parse_mode": item["parse_mode"],
+            },
+        )
+
+    def _deliver_photos(self, items: List[Dict[str, Any]]) -> bool:
+        if len(items) == 1:
+            item = items[0]
+            return self._post(
+                "sendPhoto",
+                {
                     "chat_id": self.chat_id,
-                    "caption": caption,
-                    "parse_mode": parse_mode,
-                }
-                response = requests.post(url, files=files, data=data, timeout=15)
+                    "caption": item["caption"],
+                    "parse_mode": item["parse_mode"],
+                },
+                files={
+                    "photo": ("visitor.jpg", self._prepare_photo(item["photo"]), "image/jpeg")
+                },
+            )
 
-            if response.status_code == 200:
-                print(f"[📱] Telegram photo sent successfully")
-                return True
+        # One album: the newest caption describes the visit, the rest are context
+        media, files = [], {}
+        for i, item in enumerate(items):
+            name = f"photo{i}"
+            entry = {"type": "photo", "media": f"attach://{name}"}
+            if i == 0:
+                entry["caption"] = (
+                    f"{items[-1]['caption']}\n\n📸 {len(items)} capturi"
+                )
+                entry["parse_mode"] = items[-1]["parse_mode"]
+            media.append(entry)
+            files[name] = (f"{name}.jpg", self._prepare_photo(item["photo"]), "image/jpeg")
+
+        return self._post(
+            "sendMediaGroup",
+            {"chat_id": self.chat_id, "media": json.dumps(media)},
+            files=files,
+        )
+
+    def _collect_visit(self, first: Dict[str, Any], deferred: List[Dict[str, Any]]):
+        """Gather photos with first's coalesce key arriving shortly after it; others go to deferred"""
+        batch = [first]
+        deadline = time.monotonic() + VISITOR_COALESCE_SECONDS
+
+        while len(batch) < MEDIA_GROUP_MAX:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                break
+            try:
+                item = self.outbox.get(timeout=remaining)
+            except queue.Empty:
+                break
+
+            if item["kind"] == "photo" and item["coalesce"] == first["coalesce"]:
+                batch.append(item)
             else:
-                print(f"[📱] Telegram photo API error: {response.status_code}")
-                return False
+                deferred.append(item)
 
-        except Exception as e:
-            print(f"[📱] Telegram photo failed: {e}")
-            return False
+        self.stats["coalesced"] += len(batch) - 1
+        return batch
+
+    def _sender_worker(self):
+        """Drain the outbox, one Telegram request at a time"""
+        deferred: List[Dict[str, Any]] = []
+
+        while True:
+            item = deferred.pop(0) if deferred else self.outbox.get()
+
+            if not self.enabled or not self.is_configured():
+                continue
+
+            try:
+                if item["kind"] == "message":
+                    sent = self._deliver_message(item)
+                elif item["coalesce"]:
+                    sent = self._deliver_photos(self._collect_visit(item, deferred))
+                else:
+                    sent = self._deliver_photos([item])
+            except Exception as e:
+                print(f"[📱] Telegram sender error: {e}")
+                sent = False
+
+            self.stats["sent" if sent else "failed"] += 1
+            print(f"[📱] Telegram {item['kind']}: {'✅ Sent' if sent else '❌ Failed'}")
 
     def send_visitor_notification(
         self,
         access_granted: bool,
         recognized_person: Optional[str] = None,
         image_path: Optional[str] = None,
+        image_data: Optional[bytes] = None,
     ) -> bool:
         """Send formatted visitor notification"""
         current_time = datetime.now().strftime("%d.%m.%Y la %H:%M:%S")
 
         if access_granted and recognized_person:
             # Known person detected
+            visit = f"granted:{recognized_person}"
             message = f"""🚪 <b>ACCES PERMIS</b>
             
 ✅ Persoană recunoscută: <b>{recognized_person}</b>
@@ -105,6 +275,7 @@ Bun venit acasă! 🏠"""
 
         else:
             # Unknown person detected
+            visit = "denied"
             message = f"""🚨 <b>VIZITATOR NECUNOSCUT</b>
             
 👤 Persoană necunoscută la ușă
@@ -113,9 +284,12 @@ Bun venit acasă! 🏠"""
 
 Răspundeți cu /open pentru a deschide ușa manual."""
 
-        # Send photo with message if available
+        # Send photo with message if available; repeated alerts with the same
+        # outcome (and person) are merged by the sender
+        if image_data is not None:
+            return self.send_photo(caption=message, image_data=image_data, coalesce=visit)
         if image_path and os.path.exists(image_path):
-            return self.send_photo(image_path, message)
+            return self.send_photo(image_path, message, coalesce=visit)
         else:
             return self.send_message(message)
 
@@ -243,6 +417,7 @@ Folosiți /help pentru a vedea comenzile disponibile."""
 
     def _command_listener_worker(self):
         """Background worker for processing Telegram commands"""
+        poll_session = requests.Session()
         while self.running:
             try:
                 url = f"https://api.telegram.org/bot{self.bot_token}/getUpdates"
@@ -252,7 +427,7 @@ Folosiți /help pentru a vedea comenzile disponibile."""
                     "allowed_updates": ["message"],
                 }
 
-                response = requests.get(url, params=params, timeout=35)
+                response = poll_session.get(url, params=params, timeout=35)
 
                 if response.status_code == 200:
                     data = response.json()
@@ -318,6 +493,8 @@ Folosiți /help pentru a vedea comenzile disponibile."""
             "listening": self.running,
             "chat_id": self.chat_id,
             "has_token": bool(self.bot_token),
+            "pending": self.outbox.qsize(),
+            **self.stats,
         }
 
 
@@ -387,7 +564,7 @@ if __name__ == "__main__":
 
         # Test message
         success = bot.send_test_notification()
-        print(f"Test notification: {'✅ Sent' if success else '❌ Failed'}")
+        print(f"Test notification: {'✅ Queued' if success else '❌ Failed'}")
 
         # Start command listener for testing
         bot.start_command_listener()